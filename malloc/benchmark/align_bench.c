@@ -0,0 +1,89 @@
+/*
+ * align_bench - Aligned buffers from mymemalign and from over-allocation.
+ *
+ * usage: ./align_bench [buffers] [mode]
+ *
+ * For each alignment, keeps buffers live buffers of random size, replacing
+ * a random one at every step, and reports throughput and heap bytes per
+ * payload byte. The buffers come either from mymemalign or, as callers
+ * do without it, from mymalloc(size + alignment - 1) with the pointer
+ * rounded up by hand.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "../mymalloc.h"
+#include "../memlib.h"
+
+#define STEPS 200000
+
+static const size_t alignments[] = { 64, 512, 4096 };
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *get(int use_memalign, size_t align, size_t size, void **raw)
+{
+    if (use_memalign)
+        return *raw = mymemalign(align, size);
+    *raw = mymalloc(size + align - 1);
+    return (void *)(((uintptr_t)*raw + align - 1) & ~(uintptr_t)(align - 1));
+}
+
+static void run(int mode, int use_memalign, size_t align, int n, void **raw, size_t *sizes)
+{
+    size_t live = 0, peak_live = 0, peak_heap = 0;
+    double start, secs;
+    int i, step;
+
+    myinit(mode);
+    srand(1);
+    start = now();
+    for (i = 0; i < n; i++) {
+        sizes[i] = 64 + rand() % 4096;
+        *(char *)get(use_memalign, align, sizes[i], &raw[i]) = 1;
+        live += sizes[i];
+    }
+    for (step = 0; step < STEPS; step++) {
+        i = rand() % n;
+        myfree(raw[i]);
+        live -= sizes[i];
+        sizes[i] = 64 + rand() % 4096;
+        *(char *)get(use_memalign, align, sizes[i], &raw[i]) = 1;
+        live += sizes[i];
+        if (live > peak_live)
+            peak_live = live;
+        if (mem_heapsize() > peak_heap)
+            peak_heap = mem_heapsize();
+    }
+    secs = now() - start;
+
+    printf("align %4zu %-10s %10.0f ops/sec  %.2f heap bytes per payload byte\n",
+           align, use_memalign ? "mymemalign" : "mymalloc", (n + STEPS) / secs,
+           (double)peak_heap / peak_live);
+    for (i = 0; i < n; i++)
+        myfree(raw[i]);
+    mycleanup();
+}
+
+int main(int argc, char **argv)
+{
+    int n = (argc > 1) ? atoi(argv[1]) : 2000;
+    int mode = (argc > 2) ? atoi(argv[2]) : 3;
+    void **raw = malloc(n * sizeof(void *));
+    size_t *sizes = malloc(n * sizeof(size_t));
+    size_t i;
+
+    for (i = 0; i < sizeof(alignments) / sizeof(alignments[0]); i++) {
+        run(mode, 0, alignments[i], n, raw, sizes);
+        run(mode, 1, alignments[i], n, raw, sizes);
+    }
+    free(raw);
+    free(sizes);
+    return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * calloc_bench - Zeroed allocation with mycalloc and with mymalloc+memset.
+ *
+ * usage: ./calloc_bench [blocks] [mode]
+ *
+ * For each block size, allocates blocks zeroed blocks on a new heap, where
+ * all memory is fresh from the OS, then frees every other one and
+ * allocates them again, which reuses memory that has to be cleared.
+ * Reports the time per allocation of both phases, first with mymalloc
+ * followed by memset and then with mycalloc, and how many callocs did
+ * not have to clear their block.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../mymalloc.h"
+#include "../mm.h"
+
+static const size_t block_sizes[] = { 128, 512, 2048, 8192, 32768 };
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *zalloc(int use_calloc, size_t size)
+{
+    void *p;
+
+    if (use_calloc)
+        return mycalloc(1, size);
+    if ((p = mymalloc(size)) != NULL)
+        memset(p, 0, size);
+    return p;
+}
+
+/*
+ * first_nonzero - Offset of the first non-zero byte of p, or size if all
+ *    size bytes are zero
+ */
+static size_t first_nonzero(const char *p, size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size && p[i] == 0; i++)
+        ;
+    return i;
+}
+
+static void run(int mode, int use_calloc, size_t size, int n, char **blocks)
+{
+    struct mm_stats st;
+    double start, fresh, reused;
+    size_t off;
+    int i;
+
+    myinit(mode);
+
+    start = now();
+    for (i = 0; i < n; i++)
+        blocks[i] = zalloc(use_calloc, size);
+    fresh = now() - start;
+    for (i = 0; i < n; i += 2)
+        myfree(blocks[i]);
+    start = now();
+    for (i = 0; i < n; i += 2)
+        blocks[i] = zalloc(use_calloc, size);
+    reused = now() - start;
+    /* The whole block, so that a stale header or footer left inside it
+     * by a merge is caught too */
+    for (i = 0; i < n; i++)
+        if ((off = first_nonzero(blocks[i], size)) < size)
+            printf("block %d is not zero at byte %zu\n", i, off);
+
+    mm_stats(&st);
+    printf("size %5zu %-13s fresh %7.1f ns  reused %7.1f ns  (%zu not cleared, %zu cleared)\n",
+           size, use_calloc ? "mycalloc" : "mymalloc+set", 1e9 * fresh / n,
+           1e9 * reused / ((n + 1) / 2), st.calloc_fresh, st.calloc_cleared);
+    for (i = 0; i < n; i++)
+        myfree(blocks[i]);
+    mycleanup();
+}
+
+int main(int argc, char **argv)
+{
+    int n = (argc > 1) ? atoi(argv[1]) : 20000;
+    int mode = (argc > 2) ? atoi(argv[2]) : 3;
+    char **blocks = malloc(n * sizeof(char *));
+    size_t i;
+
+    for (i = 0; i < sizeof(block_sizes) / sizeof(block_sizes[0]); i++) {
+        run(mode, 0, block_sizes[i], n, blocks);
+        run(mode, 1, block_sizes[i], n, blocks);
+    }
+    free(blocks);
+    return 0;
+}
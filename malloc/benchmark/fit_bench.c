@@ -0,0 +1,102 @@
+/*
+ * fit_bench - Compare placement policies on a random alloc/free workload.
+ *
+ * usage: ./fit_bench [ops] [mode ...]
+ *
+ * Fills the heap with live blocks, then replaces a random block with a new
+ * one of random size for ops iterations. Reports the best throughput of
+ * RUNS runs, the number of mem_sbrk'd bytes, and peak utilization (live
+ * payload / heap size).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../mymalloc.h"
+#include "../memlib.h"
+
+#define SLOTS 1500
+#define RUNS 3          /* Runs per mode, the fastest counts */
+
+static void *blocks[SLOTS];
+static size_t sizes[SLOTS];
+
+/* Mostly small requests with an occasional large one */
+static size_t random_size(void)
+{
+    if (rand() % 10 == 0)
+        return 256 + rand() % 2048;
+    return 8 + rand() % 120;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(int mode, int ops)
+{
+    size_t live, peak_live;
+    int i, r, failed;
+    double start, t, secs = 0;
+
+    for (r = 0; r < RUNS; r++) {
+        if (r > 0) {
+            for (i = 0; i < SLOTS; i++)
+                myfree(blocks[i]);
+            mycleanup();
+        }
+        myinit(mode);
+        srand(1);
+        live = 0;
+        failed = 0;
+        for (i = 0; i < SLOTS; i++) {
+            sizes[i] = random_size();
+            blocks[i] = mymalloc(sizes[i]);
+            live += sizes[i];
+        }
+        peak_live = live;
+
+        start = now();
+        for (i = 0; i < ops; i++) {
+            int slot = rand() % SLOTS;
+            myfree(blocks[slot]);
+            live -= sizes[slot];
+            sizes[slot] = random_size();
+            if ((blocks[slot] = mymalloc(sizes[slot])) == NULL) {
+                sizes[slot] = 0;
+                failed++;
+            }
+            live += sizes[slot];
+            if (live > peak_live)
+                peak_live = live;
+        }
+        t = now() - start;
+        if (r == 0 || t < secs)
+            secs = t;
+    }
+
+    printf("mode %d: %10.0f ops/sec  %5.1f ns/op  heap %7zu bytes  util %5.1f%%  failed %d\n",
+           mode, 2.0 * ops / secs, 1e9 * secs / (2.0 * ops), mem_heapsize(),
+           100.0 * peak_live / mem_heapsize(), failed);
+
+    for (i = 0; i < SLOTS; i++)
+        myfree(blocks[i]);
+    mycleanup();
+}
+
+int main(int argc, char **argv)
+{
+    int ops = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int i;
+
+    if (argc <= 2) {
+        run(0, ops);
+        run(2, ops);
+        return 0;
+    }
+    for (i = 2; i < argc; i++)
+        run(atoi(argv[i]), ops);
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * persist_bench - Warm restart from a heap file against rebuilding.
+ *
+ * usage: ./persist_bench [entries] [mode] [file]
+ *
+ * Builds a chained hash table of entries strings of 16 to 200 bytes in a
+ * heap kept in file (persist_bench.heap by default), makes it the heap's
+ * root and closes the heap. Then reopens the heap, takes the table back
+ * from the root and looks every entry up. Reports the time to build the
+ * table, to close the heap, to reattach to it, and to look everything up
+ * after reattaching, when the pages come back in from the page cache.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../mymalloc.h"
+
+struct entry {
+    struct entry *next;
+    unsigned long key;
+    char value[];
+};
+
+struct table {
+    unsigned long nbuckets;
+    unsigned long entries;
+    struct entry *buckets[];
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long hash(unsigned long key)
+{
+    return key * 0x9e3779b97f4a7c15UL;
+}
+
+static struct table *build(unsigned long n)
+{
+    struct table *t;
+    struct entry *e;
+    unsigned long i, b, len;
+
+    t = mycalloc(1, sizeof(struct table) + n * sizeof(struct entry *));
+    t->nbuckets = n;
+    for (i = 0; i < n; i++) {
+        len = 16 + rand() % 185;
+        e = mymalloc(sizeof(struct entry) + len);
+        e->key = i;
+        memset(e->value, 'a' + i % 26, len - 1);
+        e->value[len - 1] = '\0';
+        b = hash(i) % n;
+        e->next = t->buckets[b];
+        t->buckets[b] = e;
+        t->entries++;
+    }
+    return t;
+}
+
+static unsigned long lookup_all(struct table *t)
+{
+    struct entry *e;
+    unsigned long i, found = 0;
+
+    for (i = 0; i < t->entries; i++) {
+        for (e = t->buckets[hash(i) % t->nbuckets]; e != NULL; e = e->next)
+            if (e->key == i) {
+                found += (e->value[0] == (char)('a' + i % 26));
+                break;
+            }
+    }
+    return found;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long n = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+    int mode = (argc > 2) ? atoi(argv[2]) : 3;
+    const char *file = (argc > 3) ? argv[3] : "persist_bench.heap";
+    struct table *t;
+    double start, t_build, t_close, t_attach, t_lookup;
+    unsigned long found;
+
+    unlink(file);
+    mypersist(file, NULL);
+
+    start = now();
+    myinit(mode);
+    t = build(n);
+    mysetroot(t);
+    t_build = now() - start;
+    start = now();
+    mycleanup();
+    t_close = now() - start;
+
+    start = now();
+    myinit(mode);
+    t = mygetroot();
+    t_attach = now() - start;
+    if (t == NULL) {
+        fprintf(stderr, "persist_bench: no root after reattaching to %s\n", file);
+        return 1;
+    }
+    start = now();
+    found = lookup_all(t);
+    t_lookup = now() - start;
+    mycleanup();
+    unlink(file);
+
+    printf("%lu entries, %lu found after reattaching\n", n, found);
+    printf("build %9.1f ms\n", 1e3 * t_build);
+    printf("close %9.1f ms\n", 1e3 * t_close);
+    printf("attach %8.3f ms\n", 1e3 * t_attach);
+    printf("lookup %8.1f ms\n", 1e3 * t_lookup);
+    return found != n;
+}
@@ -0,0 +1,89 @@
+/*
+ * prof_bench - Cost and accuracy of the sampling heap profiler.
+ *
+ * usage: ./prof_bench [ops] [mode]
+ *
+ * Keeps a pool of live blocks of 16 to 1024 bytes and replaces a random
+ * one ops times, first with the profiler off and then with shorter and
+ * shorter sampling periods. Reports the best time per malloc/free pair of
+ * three runs, the slowdown against no profiling, the live samples at the
+ * end and the live bytes they add up to against the allocator's exact
+ * count.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../mymalloc.h"
+#include "../mm.h"
+
+#define LIVE 4096       /* Blocks kept live */
+#define MAXSIZE 1024    /* Largest block */
+#define RUNS 3          /* Runs per period, the fastest counts */
+
+static const size_t periods[] = { 0, 1 << 20, 512 << 10, 64 << 10, 8 << 10, 1 << 10, 128 };
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(int mode, size_t period, int ops, double base)
+{
+    static void *live[LIVE];
+    struct mm_stats st;
+    double start, t, ns = 0;
+    int r, i, j;
+
+    mymallopt(MM_PROFILE_PERIOD, period);
+    for (r = 0; r < RUNS; r++) {
+        if (r > 0) {
+            for (i = 0; i < LIVE; i++)
+                myfree(live[i]);
+            mycleanup();
+        }
+        myinit(mode);
+        srand(1);
+        for (i = 0; i < LIVE; i++)
+            live[i] = mymalloc(16 + rand() % (MAXSIZE - 15));
+        start = now();
+        for (i = 0; i < ops; i++) {
+            j = rand() % LIVE;
+            myfree(live[j]);
+            live[j] = mymalloc(16 + rand() % (MAXSIZE - 15));
+        }
+        t = 1e9 * (now() - start) / ops;
+        if (r == 0 || t < ns)
+            ns = t;
+    }
+
+    mm_stats(&st);
+    printf("period %8zu: %6.1f ns/pair", period, ns);
+    if (base > 0)
+        printf(" (%+5.1f%%)", 100.0 * (ns - base) / base);
+    else
+        printf("          ");
+    printf("  %5zu samples live, %9zu bytes estimated, %9zu exact\n",
+           st.profile_samples, st.profile_bytes, st.live_bytes);
+
+    for (i = 0; i < LIVE; i++)
+        myfree(live[i]);
+    mycleanup();
+    return ns;
+}
+
+int main(int argc, char **argv)
+{
+    int ops = (argc > 1) ? atoi(argv[1]) : 2000000;
+    int mode = (argc > 2) ? atoi(argv[2]) : 3;
+    double base = 0;
+    size_t i;
+
+    for (i = 0; i < sizeof(periods) / sizeof(periods[0]); i++) {
+        double ns = run(mode, periods[i], ops, base);
+        if (periods[i] == 0)
+            base = ns;
+    }
+    return 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * realloc_bench - Count the copies realloc avoids on vector-style growth.
+ *
+ * usage: ./realloc_bench [vectors] [elements] [mode ...]
+ *
+ * Grows each of several vectors one element at a time, doubling the
+ * capacity (or adding a fixed step, every other vector) with myrealloc,
+ * while short-lived blocks come and go in between. Then shrinks every
+ * vector to half its size. Reports throughput and how many reallocs of an
+ * existing block resized it where it was, slid it into the free block
+ * before it, or had to copy it to a new block.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../mymalloc.h"
+#include "../mm.h"
+
+#define ELEM 8          /* Bytes per element */
+#define TEMPS 32        /* Short-lived blocks kept around */
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(int mode, int nvec, int nelem)
+{
+    char **vec = calloc(nvec, sizeof(char *));
+    size_t *cap = calloc(nvec, sizeof(size_t));
+    void *temp[TEMPS] = { 0 };
+    struct mm_stats st;
+    long reallocs = 0;
+    double start, secs;
+    int i, v;
+
+    myinit(mode);
+    srand(1);
+    start = now();
+    for (i = 0; i < nelem; i++) {
+        for (v = 0; v < nvec; v++) {
+            if (i * ELEM >= cap[v]) {
+                cap[v] = (v % 2) ? cap[v] + 64 * ELEM : (cap[v] ? 2 * cap[v] : 4 * ELEM);
+                vec[v] = myrealloc(vec[v], cap[v]);
+                reallocs++;
+            }
+            vec[v][i * ELEM] = (char)i;
+        }
+        if (i % 4 == 0) {
+            int t = rand() % TEMPS;
+            myfree(temp[t]);
+            temp[t] = mymalloc(16 + rand() % 240);
+        }
+    }
+    for (v = 0; v < nvec; v++) {
+        cap[v] /= 2;
+        vec[v] = myrealloc(vec[v], cap[v]);
+        reallocs++;
+    }
+    secs = now() - start;
+
+    mm_stats(&st);
+    printf("mode %d: %9.0f reallocs/sec  %ld reallocs: %zu in place, %zu moved down, "
+           "%zu copied (%.1f%% avoided)\n",
+           mode, reallocs / secs, reallocs, st.realloc_inplace, st.realloc_moved,
+           st.realloc_copied,
+           100.0 * (st.realloc_inplace + st.realloc_moved) /
+           (st.realloc_inplace + st.realloc_moved + st.realloc_copied));
+
+    for (v = 0; v < nvec; v++)
+        myfree(vec[v]);
+    for (i = 0; i < TEMPS; i++)
+        myfree(temp[i]);
+    mycleanup();
+    free(vec);
+    free(cap);
+}
+
+int main(int argc, char **argv)
+{
+    int nvec = (argc > 1) ? atoi(argv[1]) : 16;
+    int nelem = (argc > 2) ? atoi(argv[2]) : 20000;
+    int i;
+
+    if (argc <= 3) {
+        run(0, nvec, nelem);
+        run(2, nvec, nelem);
+        run(3, nvec, nelem);
+        return 0;
+    }
+    for (i = 3; i < argc; i++)
+        run(atoi(argv[i]), nvec, nelem);
+    return 0;
+}
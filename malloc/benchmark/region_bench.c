@@ -0,0 +1,98 @@
+/*
+ * region_bench - Request-scoped objects freed one by one or all at once.
+ *
+ * usage: ./region_bench [requests] [objects] [mode]
+ *
+ * Simulates requests that each allocate objects objects of 16 to 256
+ * bytes, touch them and then drop all of them when the request ends.
+ * The objects are freed one by one with myfree, dropped with a single
+ * myregion_reset, or, as a baseline, freed one by one with the C
+ * library's free. Reports the time per object, allocation and free
+ * together.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../mymalloc.h"
+#include "../memlib.h"
+#include "../region.h"
+
+#define MINSIZE 16
+#define MAXSIZE 256
+
+enum { MYMALLOC, REGION, LIBC };
+static const char *names[] = { "mymalloc/myfree", "myregion", "malloc/free" };
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(int how, int mode, int requests, int n, char **objs, size_t *sizes)
+{
+    struct region *r = NULL;
+    double start, secs;
+    size_t held = 0;
+    int q, i;
+
+    myinit(mode);
+    if (how == REGION)
+        r = myregion_create(0);
+
+    start = now();
+    for (q = 0; q < requests; q++) {
+        for (i = 0; i < n; i++) {
+            if (how == MYMALLOC)
+                objs[i] = mymalloc(sizes[i]);
+            else if (how == REGION)
+                objs[i] = myregion_alloc(r, sizes[i]);
+            else
+                objs[i] = malloc(sizes[i]);
+            objs[i][0] = (char)i;
+        }
+        if (how == REGION) {
+            myregion_reset(r);
+        } else {
+            for (i = 0; i < n; i++)
+                if (how == MYMALLOC)
+                    myfree(objs[i]);
+                else
+                    free(objs[i]);
+        }
+    }
+    secs = now() - start;
+
+    if (how == REGION) {
+        held = region_size(r);
+        myregion_destroy(r);
+    } else if (how == MYMALLOC) {
+        held = mem_heapsize();
+    }
+    printf("%-16s %6.1f ns/object", names[how], 1e9 * secs / ((double)requests * n));
+    if (how != LIBC)
+        printf("  %8zu bytes held", held);
+    printf("\n");
+    mycleanup();
+}
+
+int main(int argc, char **argv)
+{
+    int requests = (argc > 1) ? atoi(argv[1]) : 2000;
+    int n = (argc > 2) ? atoi(argv[2]) : 1000;
+    int mode = (argc > 3) ? atoi(argv[3]) : 3;
+    char **objs = malloc(n * sizeof(char *));
+    size_t *sizes = malloc(n * sizeof(size_t));
+    int i;
+
+    srand(1);
+    for (i = 0; i < n; i++)
+        sizes[i] = MINSIZE + rand() % (MAXSIZE - MINSIZE + 1);
+    run(MYMALLOC, mode, requests, n, objs, sizes);
+    run(REGION, mode, requests, n, objs, sizes);
+    run(LIBC, mode, requests, n, objs, sizes);
+    free(objs);
+    free(sizes);
+    return 0;
+}
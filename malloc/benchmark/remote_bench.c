@@ -0,0 +1,101 @@
+/*
+ * remote_bench - Producer/consumer frees between threads.
+ *
+ * usage: ./remote_bench [pairs] [blocks_per_producer] [arenas]
+ *
+ * Each producer allocates blocks and passes them through a ring buffer to
+ * its consumer, which frees them. Every free is of a block owned by another
+ * thread's arena, so it goes through the owner's remote free list (or the
+ * owner's lock in the remote_bench_locked build).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include "../mymalloc.h"
+#include "../mm.h"
+
+#define RING_SIZE 1024
+
+/* Single-producer single-consumer ring of blocks */
+struct ring {
+    void *slots[RING_SIZE];
+    unsigned long head;      /* Next slot to fill, written by the producer */
+    unsigned long tail;      /* Next slot to drain, written by the consumer */
+};
+
+static int blocks_per_producer;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *producer(void *arg)
+{
+    struct ring *r = arg;
+    unsigned int seed = (unsigned int)(long)r;
+    unsigned long head = 0;
+    int i;
+
+    for (i = 0; i < blocks_per_producer; i++) {
+        char *bp = mymalloc(16 + rand_r(&seed) % 496);
+        if (bp == NULL) {
+            fprintf(stderr, "mymalloc failed\n");
+            exit(1);
+        }
+        bp[0] = (char)i;
+        while (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == RING_SIZE)
+            sched_yield();
+        r->slots[head % RING_SIZE] = bp;
+        __atomic_store_n(&r->head, ++head, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    struct ring *r = arg;
+    unsigned long tail = 0;
+    int i;
+
+    for (i = 0; i < blocks_per_producer; i++) {
+        while (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail)
+            sched_yield();
+        myfree(r->slots[tail % RING_SIZE]);
+        __atomic_store_n(&r->tail, ++tail, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int pairs = (argc > 1) ? atoi(argv[1]) : 2;
+    struct ring *rings = calloc(pairs, sizeof(struct ring));
+    pthread_t *threads = calloc(2 * pairs, sizeof(pthread_t));
+    int i;
+
+    blocks_per_producer = (argc > 2) ? atoi(argv[2]) : 1000000;
+    mymallopt(MM_ARENA_MAX, (argc > 3) ? atoi(argv[3]) : 2 * pairs);
+    myinit(0);
+
+    double start = now();
+    for (i = 0; i < pairs; i++) {
+        pthread_create(&threads[2 * i], NULL, producer, &rings[i]);
+        pthread_create(&threads[2 * i + 1], NULL, consumer, &rings[i]);
+    }
+    for (i = 0; i < 2 * pairs; i++)
+        pthread_join(threads[i], NULL);
+    double secs = now() - start;
+
+    mm_checkheap(0);
+    printf("%d pairs: %12.0f blocks/sec\n", pairs,
+           (double)pairs * blocks_per_producer / secs);
+    mycleanup();
+    free(rings);
+    free(threads);
+    return 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * slab_bench - Tiny fixed-size objects with and without the slab allocator.
+ *
+ * usage: ./slab_bench [objects] [mode]
+ *
+ * For each object size, allocates objects nodes, frees every other one
+ * and allocates them again, then frees everything. Reports throughput and
+ * heap bytes per live object, first with slabs disabled (every object is
+ * a boundary-tag block of at least 24 bytes) and then with them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../mymalloc.h"
+#include "../memlib.h"
+#include "../mm.h"
+#include "../slab.h"
+
+static const size_t object_sizes[] = { 8, 16, 24, 32, 48, 64 };
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(int mode, size_t slab_max, size_t size, int n, void **objs)
+{
+    size_t heap;
+    double start, secs;
+    int i;
+
+    mymallopt(MM_SLAB_MAX, slab_max);
+    myinit(mode);
+
+    start = now();
+    for (i = 0; i < n; i++)
+        objs[i] = mymalloc(size);
+    heap = mem_heapsize();
+    for (i = 0; i < n; i += 2)
+        myfree(objs[i]);
+    for (i = 0; i < n; i += 2)
+        objs[i] = mymalloc(size);
+    for (i = 0; i < n; i++)
+        myfree(objs[i]);
+    secs = now() - start;
+
+    printf("size %2zu %-5s %10.0f ops/sec  %5.1f heap bytes/object\n",
+           size, slab_max ? "slab" : "heap", 3.0 * n / secs, (double)heap / n);
+    mycleanup();
+}
+
+int main(int argc, char **argv)
+{
+    int n = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int mode = (argc > 2) ? atoi(argv[2]) : 3;
+    void **objs = malloc(n * sizeof(void *));
+    size_t i;
+
+    for (i = 0; i < sizeof(object_sizes) / sizeof(object_sizes[0]); i++) {
+        run(mode, 0, object_sizes[i], n, objs);
+        run(mode, SLAB_MAX_SIZE, object_sizes[i], n, objs);
+    }
+    free(objs);
+    return 0;
+}
@@ -0,0 +1,580 @@
+/*
+ * stress_bench - Multi-threaded workloads with realistic object lifetimes.
+ *
+ * usage: ./stress_bench [-g] [-m mode] [-t threads] [-d seconds] [-a arenas] [workload ...]
+ *
+ *   -m mode     fit_mode of the allocator (default 3, as in libmymalloc.so)
+ *   -g          also run every workload through the C library's malloc
+ *   -t threads  run with 1..threads threads (default the number of CPUs,
+ *               at least 4)
+ *   -d seconds  length of every run (default 1)
+ *   -a arenas   number of arenas (default one per CPU)
+ *
+ * The workloads, all of them without arguments:
+ *
+ *   larson    Server simulation after Larson and Krishnan: every thread
+ *             replaces random blocks of 16 to 512 bytes in its own array.
+ *             The threads are replaced by new ones every LARSON_ROUND
+ *             replacements, and each new thread takes over the array of
+ *             another, so blocks are freed by other threads than the ones
+ *             that allocated them, and threads keep coming and going.
+ *   prodcons  Every thread allocates blocks of 16 to 1024 bytes and passes
+ *             them through a ring to the next thread, which frees them.
+ *   churn     Every thread allocates, reallocates and frees blocks of 8
+ *             bytes to 256 KB, log-uniformly distributed, in random order.
+ *   frag      Every thread allocates batches of small blocks and keeps one
+ *             in FRAG_KEEP_EVERY of them for a long time, replacing older
+ *             ones at random, and allocates and frees medium blocks in
+ *             between. The survivors pin the pages around them, so the RSS
+ *             is printed over the run, against the live bytes.
+ *
+ * Every run is a fresh child process. It reports the throughput in
+ * malloc, free and realloc calls per second, the peak and final RSS of
+ * the process, the bytes the workload holds at the end, and percentiles
+ * of the time a call takes, from one in LAT_EVERY calls.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include "../mymalloc.h"
+#include "../mm.h"
+
+#define MAX_THREADS 64
+#define LAT_EVERY 8           /* Time one call in this many */
+#define LAT_BUCKETS 336       /* Latency histogram, see lat_bucket */
+#define SAMPLES 10            /* RSS samples per run */
+
+#define LARSON_SLOTS 1000     /* Blocks per thread */
+#define LARSON_ROUND 10000    /* Replacements by a thread before it is replaced */
+#define RING 256              /* Blocks in flight between two prodcons threads */
+#define PRODCONS_BATCH 32     /* Blocks produced before consuming */
+#define CHURN_SLOTS 1024
+#define FRAG_BATCH 1024       /* Small blocks allocated per cycle */
+#define FRAG_KEEP_EVERY 16    /* One small block in this many survives */
+#define FRAG_KEEP 32768       /* Survivors per thread */
+#define FRAG_MEDIUM 64        /* Medium blocks allocated and freed per cycle */
+
+enum { LARSON, PRODCONS, CHURN, FRAG, NWORKLOADS };
+static const char *workload_names[] = { "larson", "prodcons", "churn", "frag" };
+
+struct allocator {
+    const char *name;
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+};
+
+static const struct allocator allocators[] = {
+    { "mymalloc", mymalloc, myfree, myrealloc },
+    { "glibc", malloc, free, realloc },
+};
+static const struct allocator *A;
+
+/* Ring between two prodcons threads, one producing and one consuming */
+struct ring {
+    unsigned long head __attribute__((aligned(64)));   /* Next block to consume */
+    unsigned long tail __attribute__((aligned(64)));   /* Next free slot */
+    int closed;                                        /* No more blocks will come */
+    void *blocks[RING];
+    size_t sizes[RING];
+};
+
+struct thread_state {
+    pthread_t tid;
+    unsigned int seed;
+    unsigned long ops;        /* malloc, free and realloc calls */
+    long live;                /* Bytes allocated less bytes freed */
+    uint64_t lat_max;
+    unsigned long lat[LAT_BUCKETS];
+    char **blocks;            /* The thread's blocks, larson, churn and frag */
+    size_t *sizes;
+    struct ring *in, *out;    /* prodcons */
+} __attribute__((aligned(64)));
+
+struct result {
+    double mops;              /* Million calls per second */
+    double peak_rss, final_rss, live;  /* MB */
+    double p50, p99, p999, max;        /* ns */
+    double rss[SAMPLES];      /* MB, over the run */
+    int nsamples;
+};
+
+static struct thread_state threads[MAX_THREADS];
+static struct ring rings[MAX_THREADS];
+static int nthreads;
+static int stop;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t nsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * lat_bucket - Histogram bucket of a latency of ns nanoseconds: one bucket
+ *    per ns below 16, then 8 buckets per power of two, so that a bucket
+ *    spans at most 12.5% of its values
+ */
+static int lat_bucket(uint64_t ns)
+{
+    int e, b;
+
+    if (ns < 16)
+        return (int)ns;
+    e = 63 - __builtin_clzll(ns);
+    b = 16 + (e - 4) * 8 + (int)((ns >> (e - 3)) & 7);
+    return b < LAT_BUCKETS ? b : LAT_BUCKETS - 1;
+}
+
+/* lat_upper - Largest latency that falls into bucket b */
+static double lat_upper(int b)
+{
+    int e;
+
+    if (b < 16)
+        return b;
+    e = 4 + (b - 16) / 8;
+    return (double)((uint64_t)(9 + (b - 16) % 8) << (e - 3)) - 1;
+}
+
+static void record(struct thread_state *ts, uint64_t ns)
+{
+    ts->lat[lat_bucket(ns)]++;
+    if (ns > ts->lat_max)
+        ts->lat_max = ns;
+}
+
+/* Every call goes through these, which time one in LAT_EVERY of them */
+static void *xmalloc(struct thread_state *ts, size_t size)
+{
+    uint64_t start;
+    char *p;
+
+    if (ts->ops++ % LAT_EVERY != 0) {
+        p = A->malloc(size);
+    } else {
+        start = nsec();
+        p = A->malloc(size);
+        record(ts, nsec() - start);
+    }
+    if (p == NULL) {
+        fprintf(stderr, "stress_bench: %s failed to allocate %zu bytes\n", A->name, size);
+        exit(1);
+    }
+    p[0] = p[size - 1] = (char)size;
+    ts->live += size;
+    return p;
+}
+
+static void xfree(struct thread_state *ts, void *p, size_t size)
+{
+    uint64_t start;
+
+    if (ts->ops++ % LAT_EVERY != 0) {
+        A->free(p);
+    } else {
+        start = nsec();
+        A->free(p);
+        record(ts, nsec() - start);
+    }
+    ts->live -= size;
+}
+
+static void *xrealloc(struct thread_state *ts, void *p, size_t old_size, size_t size)
+{
+    uint64_t start;
+    char *q;
+
+    if (ts->ops++ % LAT_EVERY != 0) {
+        q = A->realloc(p, size);
+    } else {
+        start = nsec();
+        q = A->realloc(p, size);
+        record(ts, nsec() - start);
+    }
+    if (q == NULL) {
+        fprintf(stderr, "stress_bench: %s failed to reallocate %zu bytes\n", A->name, size);
+        exit(1);
+    }
+    q[size - 1] = (char)size;
+    ts->live += (long)size - (long)old_size;
+    return q;
+}
+
+/*
+ * larson_worker - One round of a larson thread: LARSON_ROUND replacements
+ *    in the array it took over
+ */
+static void *larson_worker(void *arg)
+{
+    struct thread_state *ts = arg;
+    int i, slot;
+
+    for (i = 0; i < LARSON_ROUND; i++) {
+        slot = rand_r(&ts->seed) % LARSON_SLOTS;
+        if (ts->blocks[slot] != NULL)
+            xfree(ts, ts->blocks[slot], ts->sizes[slot]);
+        ts->sizes[slot] = 16 + rand_r(&ts->seed) % (512 - 16 + 1);
+        ts->blocks[slot] = xmalloc(ts, ts->sizes[slot]);
+    }
+    return NULL;
+}
+
+static void *prodcons_worker(void *arg)
+{
+    struct thread_state *ts = arg;
+    struct ring *out = ts->out, *in = ts->in;
+    unsigned long head, tail;
+    int i, moved;
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        moved = 0;
+        /* Produce a batch, as far as the ring has room */
+        tail = out->tail;
+        for (i = 0; i < PRODCONS_BATCH; i++) {
+            if (tail - __atomic_load_n(&out->head, __ATOMIC_ACQUIRE) == RING)
+                break;
+            out->sizes[tail % RING] = 16 + rand_r(&ts->seed) % (1024 - 16 + 1);
+            out->blocks[tail % RING] = xmalloc(ts, out->sizes[tail % RING]);
+            __atomic_store_n(&out->tail, ++tail, __ATOMIC_RELEASE);
+            moved++;
+        }
+        /* Consume everything the previous thread passed on */
+        head = in->head;
+        tail = __atomic_load_n(&in->tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++, moved++) {
+            xfree(ts, in->blocks[head % RING], in->sizes[head % RING]);
+            __atomic_store_n(&in->head, head + 1, __ATOMIC_RELEASE);
+        }
+        if (moved == 0)
+            sched_yield();
+    }
+
+    /* Stop producing, and free what is still coming */
+    __atomic_store_n(&out->closed, 1, __ATOMIC_RELEASE);
+    for (;;) {
+        int closed = __atomic_load_n(&in->closed, __ATOMIC_ACQUIRE);
+
+        head = in->head;
+        tail = __atomic_load_n(&in->tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            xfree(ts, in->blocks[head % RING], in->sizes[head % RING]);
+            __atomic_store_n(&in->head, head + 1, __ATOMIC_RELEASE);
+        }
+        if (closed)
+            break;
+        sched_yield();
+    }
+    return NULL;
+}
+
+/* Log-uniform between 8 bytes and 256 KB */
+static size_t churn_size(struct thread_state *ts)
+{
+    size_t s = (size_t)8 << (rand_r(&ts->seed) % 15);
+    return s + rand_r(&ts->seed) % s;
+}
+
+static void *churn_worker(void *arg)
+{
+    struct thread_state *ts = arg;
+    size_t size;
+    int slot;
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        slot = rand_r(&ts->seed) % CHURN_SLOTS;
+        if (ts->blocks[slot] == NULL) {
+            ts->sizes[slot] = churn_size(ts);
+            ts->blocks[slot] = xmalloc(ts, ts->sizes[slot]);
+        } else if (rand_r(&ts->seed) % 4 == 0) {
+            size = churn_size(ts);
+            ts->blocks[slot] = xrealloc(ts, ts->blocks[slot], ts->sizes[slot], size);
+            ts->sizes[slot] = size;
+        } else {
+            xfree(ts, ts->blocks[slot], ts->sizes[slot]);
+            ts->blocks[slot] = NULL;
+        }
+    }
+    return NULL;
+}
+
+static void *frag_worker(void *arg)
+{
+    struct thread_state *ts = arg;
+    char *batch[FRAG_BATCH], *medium[FRAG_MEDIUM];
+    size_t sizes[FRAG_BATCH], msizes[FRAG_MEDIUM];
+    int i, slot, kept = 0;
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        for (i = 0; i < FRAG_BATCH; i++) {
+            sizes[i] = 16 + rand_r(&ts->seed) % (256 - 16 + 1);
+            batch[i] = xmalloc(ts, sizes[i]);
+        }
+        for (i = 0; i < FRAG_MEDIUM; i++) {
+            msizes[i] = 2048 + rand_r(&ts->seed) % (32768 - 2048 + 1);
+            medium[i] = xmalloc(ts, msizes[i]);
+        }
+        /* Keep a few small blocks, replacing older survivors once full */
+        for (i = 0; i < FRAG_BATCH; i++) {
+            if (i % FRAG_KEEP_EVERY != 0) {
+                xfree(ts, batch[i], sizes[i]);
+                continue;
+            }
+            slot = (kept < FRAG_KEEP) ? kept++ : rand_r(&ts->seed) % FRAG_KEEP;
+            if (ts->blocks[slot] != NULL)
+                xfree(ts, ts->blocks[slot], ts->sizes[slot]);
+            ts->blocks[slot] = batch[i];
+            ts->sizes[slot] = sizes[i];
+        }
+        for (i = 0; i < FRAG_MEDIUM; i++)
+            xfree(ts, medium[i], msizes[i]);
+    }
+    return NULL;
+}
+
+/* read_rss - Current and peak RSS of this process in MB */
+static void read_rss(double *rss, double *peak)
+{
+    char line[256];
+    FILE *f = fopen("/proc/self/status", "r");
+    unsigned long kb;
+
+    *rss = *peak = 0;
+    if (f == NULL)
+        return;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "VmRSS: %lu", &kb) == 1)
+            *rss = kb / 1024.0;
+        else if (sscanf(line, "VmHWM: %lu", &kb) == 1)
+            *peak = kb / 1024.0;
+    }
+    fclose(f);
+}
+
+static void sample_rss(struct result *r)
+{
+    double peak;
+
+    if (r->nsamples < SAMPLES)
+        read_rss(&r->rss[r->nsamples++], &peak);
+}
+
+/*
+ * run - Run workload w with n threads for secs seconds, and fill in r
+ */
+static void run(int w, int n, double secs, struct result *r)
+{
+    static void *(*workers[])(void *) = {
+        larson_worker, prodcons_worker, churn_worker, frag_worker
+    };
+    struct thread_state *ts;
+    unsigned long ops = 0, hist[LAT_BUCKETS], count = 0, seen;
+    double start, end, next, elapsed, peak;
+    char **blocks;
+    size_t *sizes;
+    long live = 0;
+    int i, b, slots = (w == LARSON) ? LARSON_SLOTS : (w == CHURN) ? CHURN_SLOTS : FRAG_KEEP;
+
+    nthreads = n;
+    for (i = 0; i < n; i++) {
+        ts = &threads[i];
+        memset(ts, 0, sizeof(*ts));
+        ts->seed = i + 1;
+        ts->blocks = calloc(slots, sizeof(char *));
+        ts->sizes = calloc(slots, sizeof(size_t));
+        ts->out = &rings[i];
+        ts->in = &rings[(i + n - 1) % n];
+        memset(&rings[i], 0, sizeof(rings[i]));
+    }
+
+    memset(r, 0, sizeof(*r));
+    start = now();
+    end = start + secs;
+    next = start + secs / SAMPLES;
+    if (w == LARSON) {
+        /* Rounds of fresh threads, each taking over its neighbour's blocks */
+        while (now() < end) {
+            for (i = 0; i < n; i++)
+                pthread_create(&threads[i].tid, NULL, larson_worker, &threads[i]);
+            for (i = 0; i < n; i++)
+                pthread_join(threads[i].tid, NULL);
+            blocks = threads[0].blocks;
+            sizes = threads[0].sizes;
+            for (i = 0; i < n - 1; i++) {
+                threads[i].blocks = threads[i + 1].blocks;
+                threads[i].sizes = threads[i + 1].sizes;
+            }
+            threads[n - 1].blocks = blocks;
+            threads[n - 1].sizes = sizes;
+            if (now() >= next) {
+                sample_rss(r);
+                next += secs / SAMPLES;
+            }
+        }
+    } else {
+        stop = 0;
+        for (i = 0; i < n; i++)
+            pthread_create(&threads[i].tid, NULL, workers[w], &threads[i]);
+        while (now() < end) {
+            usleep(1e6 * secs / SAMPLES / 4);
+            if (now() >= next) {
+                sample_rss(r);
+                next += secs / SAMPLES;
+            }
+        }
+        __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+        for (i = 0; i < n; i++)
+            pthread_join(threads[i].tid, NULL);
+    }
+    elapsed = now() - start;
+
+    memset(hist, 0, sizeof(hist));
+    for (i = 0; i < n; i++) {
+        ts = &threads[i];
+        ops += ts->ops;
+        live += ts->live;
+        for (b = 0; b < LAT_BUCKETS; b++)
+            hist[b] += ts->lat[b];
+        if (ts->lat_max > r->max)
+            r->max = ts->lat_max;
+    }
+    for (b = 0; b < LAT_BUCKETS; b++)
+        count += hist[b];
+    for (b = 0, seen = 0; b < LAT_BUCKETS; b++) {
+        seen += hist[b];
+        if (r->p50 == 0 && seen >= 0.5 * count)
+            r->p50 = lat_upper(b);
+        if (r->p99 == 0 && seen >= 0.99 * count)
+            r->p99 = lat_upper(b);
+        if (r->p999 == 0 && seen >= 0.999 * count)
+            r->p999 = lat_upper(b);
+    }
+    r->mops = ops / elapsed / 1e6;
+    r->live = live / (1024.0 * 1024.0);
+    read_rss(&r->final_rss, &peak);
+    r->peak_rss = peak;
+}
+
+/*
+ * run_child - Run workload w with n threads through allocator a in a
+ *    fresh child process, so that every run starts from an empty heap and
+ *    the RSS is its own
+ */
+static int run_child(int w, int n, const struct allocator *a, int mode, int arenas,
+                     double secs, struct result *r)
+{
+    int fds[2], ok;
+    pid_t pid;
+
+    fflush(stdout);
+    if (pipe(fds) < 0 || (pid = fork()) < 0) {
+        perror("fork");
+        return 0;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        A = a;
+        if (a->malloc == mymalloc) {
+            if (arenas > 0 && !mymallopt(MM_ARENA_MAX, arenas)) {
+                fprintf(stderr, "stress_bench: bad arena count %d\n", arenas);
+                _exit(1);
+            }
+            myinit(mode);
+        }
+        run(w, n, secs, r);
+        ok = write(fds[1], r, sizeof(*r)) == sizeof(*r);
+        _exit(!ok);
+    }
+    close(fds[1]);
+    ok = read(fds[0], r, sizeof(*r)) == sizeof(*r);
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = ncpu > 4 ? ncpu : 4, mode = 3, arenas = 0, libc = 0;
+    int workloads[NWORKLOADS], nworkloads = 0, nallocs, i, j, k, n, c;
+    double secs = 1;
+    struct result r;
+
+    while ((c = getopt(argc, argv, "a:d:gm:t:")) != -1) {
+        switch (c) {
+        case 'a':
+            arenas = atoi(optarg);
+            break;
+        case 'd':
+            secs = atof(optarg) > 0 ? atof(optarg) : 1;
+            break;
+        case 'g':
+            libc = 1;
+            break;
+        case 'm':
+            mode = atoi(optarg);
+            break;
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-g] [-m mode] [-t threads] [-d seconds] [-a arenas] "
+                    "[workload ...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (max_threads < 1 || max_threads > MAX_THREADS) {
+        fprintf(stderr, "stress_bench: 1 to %d threads\n", MAX_THREADS);
+        return 1;
+    }
+    for (i = optind; i < argc && nworkloads < NWORKLOADS; i++) {
+        for (j = 0; j < NWORKLOADS && strcmp(argv[i], workload_names[j]) != 0; j++)
+            ;
+        if (j == NWORKLOADS) {
+            fprintf(stderr, "stress_bench: no workload %s\n", argv[i]);
+            return 1;
+        }
+        workloads[nworkloads++] = j;
+    }
+    if (nworkloads == 0)
+        for (nworkloads = 0; nworkloads < NWORKLOADS; nworkloads++)
+            workloads[nworkloads] = nworkloads;
+    nallocs = libc ? 2 : 1;
+
+    printf("%ld cpus, mode %d, %.1f s per run; RSS and live bytes in MB, latencies in ns\n",
+           ncpu, mode, secs);
+    printf("%-9s %-9s %3s %8s %8s %8s %8s %7s %7s %7s %9s\n", "workload", "malloc",
+           "thr", "Mcalls/s", "peakRSS", "RSS", "live", "p50", "p99", "p99.9", "max");
+    for (i = 0; i < nworkloads; i++) {
+        for (j = 0; j < nallocs; j++) {
+            for (n = 1; n <= max_threads; n++) {
+                if (!run_child(workloads[i], n, &allocators[j], mode, arenas, secs, &r))
+                    continue;
+                printf("%-9s %-9s %3d %8.2f %8.1f %8.1f %8.1f %7.0f %7.0f %7.0f %9.0f\n",
+                       workload_names[workloads[i]], allocators[j].name, n, r.mops,
+                       r.peak_rss, r.final_rss, r.live, r.p50, r.p99, r.p999, r.max);
+                if (workloads[i] == FRAG) {
+                    printf("%23s RSS over time:", "");
+                    for (k = 0; k < r.nsamples; k++)
+                        printf(" %.1f", r.rss[k]);
+                    printf("\n");
+                }
+            }
+        }
+    }
+    return 0;
+}
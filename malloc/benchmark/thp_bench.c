@@ -0,0 +1,89 @@
+/*
+ * thp_bench - A large heap with and without transparent huge pages.
+ *
+ * usage: ./thp_bench [megabytes] [ops] [mode]
+ *
+ * Fills the heap with about megabytes MB of live blocks of 64 to 1024
+ * bytes, then replaces a random block with a new one of random size for
+ * ops iterations, reading the old block and writing the new one, so that
+ * nearly every call touches a page the TLB does not hold. Runs once with
+ * 4 KB pages and once with MM_HUGEPAGES set, and reports the time per
+ * replacement, the heap size and the part of it backed by huge pages.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../mymalloc.h"
+#include "../memlib.h"
+#include "../mm.h"
+
+#define MINSIZE 64
+#define MAXSIZE 1024
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t random_size(void)
+{
+    return MINSIZE + rand() % (MAXSIZE - MINSIZE + 1);
+}
+
+static void run(int huge, int mode, size_t n, long ops, char **blocks, size_t *sizes)
+{
+    struct mm_stats st;
+    double start, secs;
+    unsigned long sum = 0;
+    size_t i;
+    long op;
+
+    mymallopt(MM_HUGEPAGES, huge);
+    myinit(mode);
+    srand(1);
+    for (i = 0; i < n; i++) {
+        sizes[i] = random_size();
+        blocks[i] = mymalloc(sizes[i]);
+        memset(blocks[i], (int)i, sizes[i]);
+    }
+
+    start = now();
+    for (op = 0; op < ops; op++) {
+        i = ((size_t)rand() * RAND_MAX + rand()) % n;
+        sum += (unsigned char)blocks[i][sizes[i] / 2];
+        myfree(blocks[i]);
+        sizes[i] = random_size();
+        blocks[i] = mymalloc(sizes[i]);
+        blocks[i][0] = (char)op;
+        blocks[i][sizes[i] - 1] = (char)op;
+    }
+    secs = now() - start;
+
+    mm_stats(&st);
+    printf("%-10s %7.1f ns/op  %6zu MB heap  %6zu MB huge  %5.1f%% coverage  (%lu)\n",
+           huge ? "hugepages" : "4K pages", 1e9 * secs / ops, st.heap_size >> 20,
+           st.huge_bytes >> 20, st.heap_size ? 100.0 * st.huge_bytes / st.heap_size : 0.0,
+           sum % 10);
+    for (i = 0; i < n; i++)
+        myfree(blocks[i]);
+    mycleanup();
+}
+
+int main(int argc, char **argv)
+{
+    size_t mb = (argc > 1) ? strtoul(argv[1], NULL, 10) : 256;
+    long ops = (argc > 2) ? atol(argv[2]) : 2000000;
+    int mode = (argc > 3) ? atoi(argv[3]) : 2;
+    size_t n = (mb << 20) / ((MINSIZE + MAXSIZE) / 2);
+    char **blocks = malloc(n * sizeof(char *));
+    size_t *sizes = malloc(n * sizeof(size_t));
+
+    run(0, mode, n, ops, blocks, sizes);
+    run(1, mode, n, ops, blocks, sizes);
+    free(blocks);
+    free(sizes);
+    return 0;
+}
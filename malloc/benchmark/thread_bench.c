@@ -0,0 +1,82 @@
+/*
+ * thread_bench - Multi-threaded malloc/free throughput.
+ *
+ * usage: ./thread_bench [max_threads] [ops_per_thread] [mode] [arenas]
+ *
+ * Every thread keeps a small working set of blocks and repeatedly frees a
+ * random one and allocates a new one of random small size. Runs with
+ * 1..max_threads threads and reports the aggregate throughput. arenas
+ * defaults to the allocator's choice of one per CPU.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../mymalloc.h"
+#include "../mm.h"
+
+#define WORKING_SET 64
+
+static int ops_per_thread;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker(void *arg)
+{
+    unsigned int seed = (unsigned int)(long)arg;
+    char *blocks[WORKING_SET];
+    int i;
+
+    for (i = 0; i < WORKING_SET; i++)
+        blocks[i] = mymalloc(16 + rand_r(&seed) % 240);
+    for (i = 0; i < ops_per_thread; i++) {
+        int slot = rand_r(&seed) % WORKING_SET;
+        size_t size = 16 + rand_r(&seed) % 240;
+        myfree(blocks[slot]);
+        if ((blocks[slot] = mymalloc(size)) == NULL) {
+            fprintf(stderr, "mymalloc failed\n");
+            exit(1);
+        }
+        blocks[slot][0] = blocks[slot][size - 1] = (char)i;
+    }
+    for (i = 0; i < WORKING_SET; i++)
+        myfree(blocks[i]);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = (argc > 1) ? atoi(argv[1]) : (ncpu > 4 ? ncpu : 4);
+    int mode = (argc > 3) ? atoi(argv[3]) : 0;
+    pthread_t *threads = calloc(max_threads, sizeof(pthread_t));
+    int nthreads, i;
+
+    ops_per_thread = (argc > 2) ? atoi(argv[2]) : 1000000;
+    if (argc > 4 && !mymallopt(MM_ARENA_MAX, atoi(argv[4]))) {
+        fprintf(stderr, "bad arena count %s\n", argv[4]);
+        return 1;
+    }
+    myinit(mode);
+    printf("%ld cpus, mode %d, %d ops per thread\n", ncpu, mode, ops_per_thread);
+    for (nthreads = 1; nthreads <= max_threads; nthreads++) {
+        double start = now();
+        for (i = 0; i < nthreads; i++)
+            pthread_create(&threads[i], NULL, worker, (void *)(long)(i + 1));
+        for (i = 0; i < nthreads; i++)
+            pthread_join(threads[i], NULL);
+        double secs = now() - start;
+        printf("%2d threads: %12.0f ops/sec\n", nthreads,
+               2.0 * nthreads * ops_per_thread / secs);
+    }
+    mycleanup();
+    free(threads);
+    return 0;
+}
@@ -0,0 +1,485 @@
+/*
+ * trace_bench - Replay allocation traces through the allocator.
+ *
+ * usage: ./trace_bench [-g] [-m modes] [-q bytes] [-r reps] [-s dir] [trace ...]
+ *
+ *   -m modes  comma separated fit_modes to replay with (default 0,1,2,3,4)
+ *   -g        also replay through the C library's malloc
+ *   -q bytes  also replay every mode with quick lists for frees of up
+ *             to bytes (MM_QUICK_MAX), shown as <mode>+q
+ *   -r reps   timed replays per trace, the fastest one counts (default 3)
+ *   -s dir    write the allocator statistics after each checked replay
+ *             to dir/<trace>.<mode>.json
+ *
+ * Without trace arguments, the traces shipped in traces/ are replayed.
+ * Each trace is first replayed once untimed, checking that every block
+ * is aligned and keeps its contents, while recording peak utilization
+ * (peak live payload / peak mem_heapsize()) and sampling external
+ * fragmentation (1 - largest free block / free bytes). Large requests
+ * are kept in the heap, with no mmap threshold, so mem_heapsize() sees
+ * them.
+ *
+ * For the C library, the heap size is mallinfo2()'s arena + mmap bytes
+ * less what was allocated before the replay, and fragmentation is not
+ * available.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "../mymalloc.h"
+#include "../memlib.h"
+#include "../mm.h"
+
+#define LIBC -1        /* Pseudo fit_mode for the C library's malloc */
+#define SAMPLES 64     /* Fragmentation samples per replay */
+#define QUICK 0x100    /* Flag on a fit_mode: replay with quick lists */
+#define MAX_MODES 16
+
+static const char *default_traces[] = {
+    "traces/random.rep", "traces/binary.rep", "traces/coalescing.rep",
+    "traces/realloc.rep", "traces/small.rep", "traces/phases.rep",
+    "traces/jq.rep", "traces/perl.rep", "traces/gcc.rep", "traces/git.rep",
+};
+
+struct op {
+    char type;         /* 'a', 'f' or 'r' */
+    int id;
+    size_t size;
+};
+
+struct trace {
+    const char *name;
+    int nids, nops;
+    struct op *ops;
+    void **blocks;
+    size_t *sizes;
+};
+
+/* Results of replaying one trace */
+struct result {
+    double secs;       /* Fastest timed replay */
+    double util;       /* Peak utilization */
+    double frag;       /* Mean external fragmentation, or < 0 if unknown */
+};
+
+/* Totals of one mode over all traces */
+struct total {
+    double secs, util, frag;
+    long ops;
+    int n, nfrag;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *mode_name(int mode)
+{
+    static const char *names[] = { "first", "next", "best", "seg", "addr" };
+    static const char *quick_names[] = { "first+q", "next+q", "best+q", "seg+q", "addr+q" };
+
+    if (mode == LIBC)
+        return "libc";
+    if (mode & QUICK)
+        return ((mode & ~QUICK) < 5) ? quick_names[mode & ~QUICK] : "?";
+    return (mode >= 0 && mode < 5) ? names[mode] : "?";
+}
+
+/*
+ * map_array - Memory for the driver's own arrays. It is mmapped so the
+ *    C library's heap only holds what a replay allocates.
+ */
+static void *map_array(size_t size)
+{
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    return p;
+}
+
+/*
+ * read_trace - Load a trace in the CS:APP format: a header of peak
+ *    payload, number of ids, number of ops and weight, then one
+ *    "a id size", "r id size" or "f id" per line.
+ */
+static int read_trace(const char *path, struct trace *t)
+{
+    FILE *fp = fopen(path, "r");
+    unsigned long peak, weight;
+    char type[2];
+    int i;
+
+    if (fp == NULL) {
+        perror(path);
+        return 0;
+    }
+    t->name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    if (fscanf(fp, "%lu %d %d %lu", &peak, &t->nids, &t->nops, &weight) != 4 ||
+        t->nids <= 0 || t->nops <= 0) {
+        fprintf(stderr, "%s: bad header\n", path);
+        fclose(fp);
+        return 0;
+    }
+    t->ops = map_array(t->nops * sizeof(struct op));
+    t->blocks = map_array(t->nids * sizeof(void *));
+    t->sizes = map_array(t->nids * sizeof(size_t));
+    for (i = 0; i < t->nops; i++) {
+        struct op *o = &t->ops[i];
+        if (fscanf(fp, "%1s %d", type, &o->id) != 2 ||
+            o->id < 0 || o->id >= t->nids ||
+            (type[0] != 'f' && fscanf(fp, "%zu", &o->size) != 1)) {
+            fprintf(stderr, "%s: bad op %d\n", path, i);
+            fclose(fp);
+            return 0;
+        }
+        o->type = type[0];
+    }
+    fclose(fp);
+    return 1;
+}
+
+/* Allocator calls for a mode */
+static void *do_malloc(int mode, size_t size)
+{
+    return (mode == LIBC) ? malloc(size) : mymalloc(size);
+}
+
+static void do_free(int mode, void *p)
+{
+    if (mode == LIBC)
+        free(p);
+    else
+        myfree(p);
+}
+
+static void *do_realloc(int mode, void *p, size_t size)
+{
+    return (mode == LIBC) ? realloc(p, size) : myrealloc(p, size);
+}
+
+/* Bytes allocated from the C library before a replay, by stdio */
+static size_t libc_base;
+static const char *stats_dir;   /* -s */
+static size_t quick_max;        /* -q */
+
+static void start(int mode)
+{
+    if (mode != LIBC) {
+        mymallopt(MM_MMAP_THRESHOLD, SIZE_MAX);
+        mymallopt(MM_QUICK_MAX, (mode & QUICK) ? quick_max : 0);
+        myinit(mode & ~QUICK);
+    }
+}
+
+static void stop(int mode)
+{
+    if (mode != LIBC)
+        mycleanup();
+}
+
+/* Bytes the allocator holds from the system */
+static size_t heap_size(int mode)
+{
+    if (mode == LIBC) {
+        struct mallinfo2 mi = mallinfo2();
+        return mi.arena + mi.hblkhd - libc_base;
+    }
+    return mem_heapsize();
+}
+
+/* Does block id still hold its fill pattern in its first n bytes? */
+static int intact(struct trace *t, int id, size_t n)
+{
+    unsigned char *p = t->blocks[id];
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        if (p[i] != (unsigned char)id)
+            return 0;
+    return 1;
+}
+
+/* dump_stats - Write the statistics of the replay of t to stats_dir */
+static void dump_stats(int mode, struct trace *t)
+{
+    char path[512];
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/%s.%s.json", stats_dir, t->name, mode_name(mode));
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        perror(path);
+        return;
+    }
+    mm_stats_dump(fd);
+    close(fd);
+}
+
+/*
+ * check_replay - Untimed replay of t that verifies every block and
+ *    measures utilization and fragmentation
+ */
+static int check_replay(int mode, struct trace *t, struct result *r)
+{
+    size_t live = 0, peak_live = 0, peak_heap = 0, n;
+    const char *err = NULL;
+    double frag = 0;
+    int i, nfrag = 0, every = t->nops / SAMPLES + 1;
+
+    if (mode == LIBC) {
+        struct mallinfo2 mi;
+        malloc_trim(0);
+        mi = mallinfo2();
+        libc_base = mi.uordblks + mi.hblkhd;
+    }
+    start(mode);
+    for (i = 0; i < t->nops && err == NULL; i++) {
+        struct op *o = &t->ops[i];
+        void *p;
+
+        switch (o->type) {
+        case 'a':
+            if ((p = do_malloc(mode, o->size)) == NULL) {
+                err = "malloc failed";
+                continue;
+            }
+            t->blocks[o->id] = p;
+            t->sizes[o->id] = o->size;
+            memset(p, o->id, o->size);
+            live += o->size;
+            break;
+        case 'r':
+            n = (o->size < t->sizes[o->id]) ? o->size : t->sizes[o->id];
+            if ((p = do_realloc(mode, t->blocks[o->id], o->size)) == NULL) {
+                err = "realloc failed";
+                continue;
+            }
+            t->blocks[o->id] = p;
+            if (!intact(t, o->id, n)) {
+                err = "realloc lost the block's contents";
+                continue;
+            }
+            memset(p, o->id, o->size);
+            live += o->size - t->sizes[o->id];
+            t->sizes[o->id] = o->size;
+            break;
+        default:
+            if (!intact(t, o->id, t->sizes[o->id])) {
+                err = "block was overwritten before its free";
+                continue;
+            }
+            do_free(mode, t->blocks[o->id]);
+            live -= t->sizes[o->id];
+            break;
+        }
+        if ((uintptr_t)t->blocks[o->id] % 8) {
+            err = "block is not aligned";
+            continue;
+        }
+        if (live > peak_live)
+            peak_live = live;
+        if (heap_size(mode) > peak_heap)
+            peak_heap = heap_size(mode);
+        if (mode != LIBC && i % every == 0) {
+            struct mm_stats st;
+            mm_stats(&st);
+            if (st.free_bytes > 0) {
+                frag += 1.0 - (double)st.largest_free_block / st.free_bytes;
+                nfrag++;
+            }
+        }
+    }
+    if (err == NULL && mode != LIBC) {
+        mm_checkheap(0);
+        if (stats_dir != NULL)
+            dump_stats(mode, t);
+    }
+    stop(mode);
+    if (err != NULL) {
+        printf("%s: %s: %s at op %d\n", t->name, mode_name(mode), err, i - 1);
+        return 0;
+    }
+
+    r->util = peak_heap ? (double)peak_live / peak_heap : 0;
+    r->frag = (mode == LIBC || nfrag == 0) ? -1 : frag / nfrag;
+    return 1;
+}
+
+/* timed_replay - Replay t without touching the blocks, return seconds */
+static double timed_replay(int mode, struct trace *t)
+{
+    double begin;
+    int i;
+
+    start(mode);
+    begin = now();
+    for (i = 0; i < t->nops; i++) {
+        struct op *o = &t->ops[i];
+        if (o->type == 'a')
+            t->blocks[o->id] = do_malloc(mode, o->size);
+        else if (o->type == 'r')
+            t->blocks[o->id] = do_realloc(mode, t->blocks[o->id], o->size);
+        else
+            do_free(mode, t->blocks[o->id]);
+    }
+    begin = now() - begin;
+    stop(mode);
+    return begin;
+}
+
+/* measure - Check trace t, then time reps replays of it */
+static int measure(int mode, struct trace *t, int reps, struct result *r)
+{
+    int k;
+
+    if (!check_replay(mode, t, r))
+        return 0;
+    r->secs = timed_replay(mode, t);
+    for (k = 1; k < reps; k++) {
+        double secs = timed_replay(mode, t);
+        if (secs < r->secs)
+            r->secs = secs;
+    }
+    return 1;
+}
+
+/*
+ * replay - Measure trace t. The C library's malloc runs in a child process
+ *    so that every trace starts from the same, nearly empty heap.
+ */
+static int replay(int mode, struct trace *t, int reps, struct result *r)
+{
+    int fds[2], ok;
+    pid_t pid;
+
+    if (mode != LIBC)
+        return measure(mode, t, reps, r);
+
+    fflush(stdout);
+    if (pipe(fds) < 0 || (pid = fork()) < 0) {
+        perror("fork");
+        return 0;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        ok = measure(mode, t, reps, r) && write(fds[1], r, sizeof(*r)) == sizeof(*r);
+        fflush(stdout);
+        _exit(!ok);
+    }
+    close(fds[1]);
+    ok = read(fds[0], r, sizeof(*r)) == sizeof(*r);
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    return ok;
+}
+
+static void print_row(const char *name, int mode, double opsec, double util, double frag)
+{
+    printf("%-16s %-7s %12.0f  %6.1f%%", name, mode_name(mode), opsec, 100 * util);
+    if (frag >= 0)
+        printf("  %6.1f%%\n", 100 * frag);
+    else
+        printf("  %7s\n", "-");
+}
+
+int main(int argc, char **argv)
+{
+    int modes[MAX_MODES] = { 0, 1, 2, 3, 4 }, nmodes = 5;
+    struct total totals[MAX_MODES + 1];
+    int reps = 3, libc = 0, ntraces, i, j, c;
+    const char **paths;
+    char *tok;
+
+    while ((c = getopt(argc, argv, "gm:q:r:s:")) != -1) {
+        switch (c) {
+        case 'g':
+            libc = 1;
+            break;
+        case 'm':
+            nmodes = 0;
+            for (tok = strtok(optarg, ","); tok && nmodes < MAX_MODES / 2; tok = strtok(NULL, ","))
+                modes[nmodes++] = atoi(tok);
+            break;
+        case 'q':
+            quick_max = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            reps = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        case 's':
+            stats_dir = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-g] [-m modes] [-q bytes] [-r reps] [-s dir] [trace ...]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (quick_max > 0) {
+        /* Each mode with quick lists right after the mode without */
+        for (j = nmodes - 1; j >= 0; j--) {
+            modes[2*j + 1] = modes[j] | QUICK;
+            modes[2*j] = modes[j];
+        }
+        nmodes *= 2;
+    }
+    if (libc)
+        modes[nmodes++] = LIBC;
+    if (optind < argc) {
+        paths = (const char **)argv + optind;
+        ntraces = argc - optind;
+    } else {
+        paths = default_traces;
+        ntraces = sizeof(default_traces) / sizeof(default_traces[0]);
+    }
+    memset(totals, 0, sizeof(totals));
+
+    printf("%-16s %-7s %12s  %7s  %7s\n", "trace", "mode", "ops/sec", "util", "frag");
+    for (i = 0; i < ntraces; i++) {
+        struct trace t;
+
+        if (!read_trace(paths[i], &t))
+            continue;
+        for (j = 0; j < nmodes; j++) {
+            struct result r;
+            if (!replay(modes[j], &t, reps, &r))
+                continue;
+            print_row(t.name, modes[j], t.nops / r.secs, r.util, r.frag);
+
+            totals[j].secs += r.secs;
+            totals[j].ops += t.nops;
+            totals[j].util += r.util;
+            totals[j].n++;
+            if (r.frag >= 0) {
+                totals[j].frag += r.frag;
+                totals[j].nfrag++;
+            }
+        }
+        munmap(t.ops, t.nops * sizeof(struct op));
+        munmap(t.blocks, t.nids * sizeof(void *));
+        munmap(t.sizes, t.nids * sizeof(size_t));
+    }
+
+    /* Throughput over all traces, mean utilization and fragmentation */
+    for (j = 0; j < nmodes; j++) {
+        struct total *s = &totals[j];
+        if (s->n == 0)
+            continue;
+        print_row("total", modes[j], s->ops / s->secs, s->util / s->n,
+                  s->nfrag ? s->frag / s->nfrag : -1);
+    }
+    return 0;
+}
@@ -0,0 +1,267 @@
+/*
+ * trace_gen - Write the synthetic allocation traces in traces/.
+ *
+ * usage: ./trace_gen [dir]
+ *
+ * Each trace is deterministic, so rerunning this reproduces the shipped
+ * files exactly. See README for the trace format.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_OPS 60000
+#define MAX_IDS 40000
+
+struct op {
+    char type;      /* 'a', 'f' or 'r' */
+    int id;
+    size_t size;
+};
+
+static struct op ops[MAX_OPS];
+static int nops, nids;
+static size_t sizes[MAX_IDS];
+static int live[MAX_IDS];
+
+/* Small LCG so the traces do not depend on the C library's rand() */
+static unsigned long seed;
+
+static unsigned long rnd(unsigned long n)
+{
+    seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+    return (seed >> 33) % n;
+}
+
+static void emit(char type, int id, size_t size)
+{
+    if (nops == MAX_OPS) {
+        fprintf(stderr, "trace_gen: too many ops\n");
+        exit(1);
+    }
+    ops[nops].type = type;
+    ops[nops].id = id;
+    ops[nops].size = size;
+    nops++;
+}
+
+static int alloc(size_t size)
+{
+    int id = nids++;
+
+    sizes[id] = size;
+    live[id] = 1;
+    emit('a', id, size);
+    return id;
+}
+
+static void release(int id)
+{
+    live[id] = 0;
+    emit('f', id, 0);
+}
+
+static void resize(int id, size_t size)
+{
+    sizes[id] = size;
+    emit('r', id, size);
+}
+
+/* Start a new trace */
+static void begin(unsigned long s)
+{
+    nops = nids = 0;
+    seed = s;
+    memset(live, 0, sizeof(live));
+}
+
+/* Free whatever is still live, then write the trace to dir/name */
+static void finish(const char *dir, const char *name)
+{
+    size_t cur = 0, peak = 0, osize[MAX_IDS];
+    char path[256];
+    FILE *fp;
+    int i;
+
+    for (i = 0; i < nids; i++)
+        if (live[i])
+            release(i);
+
+    /* The first header line is the peak live payload */
+    for (i = 0; i < nops; i++) {
+        if (ops[i].type == 'a') {
+            cur += ops[i].size;
+        } else if (ops[i].type == 'r') {
+            cur += ops[i].size - osize[ops[i].id];
+        } else {
+            cur -= osize[ops[i].id];
+        }
+        osize[ops[i].id] = (ops[i].type == 'f') ? 0 : ops[i].size;
+        if (cur > peak)
+            peak = cur;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if ((fp = fopen(path, "w")) == NULL) {
+        perror(path);
+        exit(1);
+    }
+    fprintf(fp, "%zu\n%d\n%d\n1\n", peak, nids, nops);
+    for (i = 0; i < nops; i++) {
+        if (ops[i].type == 'f')
+            fprintf(fp, "f %d\n", ops[i].id);
+        else
+            fprintf(fp, "%c %d %zu\n", ops[i].type, ops[i].id, ops[i].size);
+    }
+    fclose(fp);
+    printf("%-16s %6d ids %6d ops  peak %zu bytes\n", name, nids, nops, peak);
+}
+
+/* Random alloc/free mix, sizes uniform up to 4K */
+static void random_trace(const char *dir)
+{
+    int ids[2000], n = 0, i;
+
+    begin(1);
+    while (nops < 24000) {
+        if (n < 2000 && (n == 0 || rnd(100) < 55)) {
+            ids[n++] = alloc(1 + rnd(4096));
+        } else {
+            i = rnd(n);
+            release(ids[i]);
+            ids[i] = ids[--n];
+        }
+    }
+    finish(dir, "random.rep");
+}
+
+/* Interleaved small and large blocks; freeing the large ones leaves
+ * holes too small for the next, slightly larger, requests */
+static void binary_trace(const char *dir)
+{
+    int small[2000], large[2000];
+    int round, i;
+
+    begin(2);
+    for (round = 0; round < 3; round++) {
+        for (i = 0; i < 2000; i++) {
+            small[i] = alloc(64);
+            large[i] = alloc(448);
+        }
+        for (i = 0; i < 2000; i++)
+            release(large[i]);
+        for (i = 0; i < 2000; i++)
+            large[i] = alloc(512);
+        for (i = 0; i < 2000; i++) {
+            release(small[i]);
+            release(large[i]);
+        }
+    }
+    finish(dir, "binary.rep");
+}
+
+/* Pairs of neighbours freed and replaced by one block of their combined
+ * size, which only fits if they were coalesced */
+static void coalescing_trace(const char *dir)
+{
+    int i, x, y, big = -1;
+
+    begin(3);
+    for (i = 0; i < 6000; i++) {
+        x = alloc(4072);
+        y = alloc(4072);
+        release(x);
+        release(y);
+        if (big >= 0)
+            release(big);
+        big = alloc(8160);
+    }
+    finish(dir, "coalescing.rep");
+}
+
+/* A few buffers growing by realloc, with short-lived blocks allocated
+ * in between so that growing in place is not always possible */
+static void realloc_trace(const char *dir)
+{
+    int buf[8], tmp[64], ntmp = 0, i, b;
+
+    begin(4);
+    for (i = 0; i < 8; i++)
+        buf[i] = alloc(512);
+    for (i = 0; nops < 24000; i++) {
+        b = rnd(8);
+        if (sizes[buf[b]] > 600000) {
+            release(buf[b]);
+            buf[b] = alloc(512);
+        } else {
+            resize(buf[b], sizes[buf[b]] + 1 + rnd(sizes[buf[b]] / 4 + 64));
+        }
+        if (ntmp < 64 && rnd(2)) {
+            tmp[ntmp++] = alloc(16 + rnd(200));
+        } else if (ntmp > 0) {
+            b = rnd(ntmp);
+            release(tmp[b]);
+            tmp[b] = tmp[--ntmp];
+        }
+    }
+    finish(dir, "realloc.rep");
+}
+
+/* Churn of tiny list and tree nodes */
+static void small_trace(const char *dir)
+{
+    static const size_t node[] = { 8, 12, 16, 24, 32, 40, 48, 64 };
+    int ids[6000], n = 0, i;
+
+    begin(5);
+    while (nops < 30000) {
+        if (n < 6000 && (n < 100 || rnd(100) < 52)) {
+            ids[n++] = alloc(node[rnd(8)]);
+        } else {
+            i = (rnd(4) == 0) ? rnd(n) : n - 1 - rnd(n < 16 ? n : 16);
+            release(ids[i]);
+            ids[i] = ids[--n];
+        }
+    }
+    finish(dir, "small.rep");
+}
+
+/* Program phases: build up a working set with a skewed mix of sizes, free
+ * most of it except some long-lived blocks, and start over */
+static void phases_trace(const char *dir)
+{
+    int ids[5000], n, i, phase;
+    size_t size;
+
+    begin(6);
+    for (phase = 0; phase < 6; phase++) {
+        n = 0;
+        for (i = 0; i < 2500; i++) {
+            /* Mostly small, occasionally a few kilobytes or more */
+            size = 8 << rnd(rnd(10) + 1);
+            ids[n++] = alloc(size + rnd(size));
+            if (rnd(3) == 0) {
+                int j = rnd(n);
+                release(ids[j]);
+                ids[j] = ids[--n];
+            }
+        }
+        for (i = 0; i < n; i++)
+            if (rnd(10) != 0)
+                release(ids[i]);
+    }
+    finish(dir, "phases.rep");
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = (argc > 1) ? argv[1] : "traces";
+
+    random_trace(dir);
+    binary_trace(dir);
+    coalescing_trace(dir);
+    realloc_trace(dir);
+    small_trace(dir);
+    phases_trace(dir);
+    return 0;
+}
@@ -0,0 +1,431 @@
+/*
+ * heapprof.c - Sampling heap profiler: which call stacks hold live memory.
+ *
+ * When a sampling period of N bytes is set, every thread samples the
+ * allocation that ends a run of allocated bytes whose length is drawn
+ * from an exponential distribution with mean N, so on average one sample
+ * is taken every N bytes and the chance that a block is sampled grows
+ * with its size. A sample records the block's address and size and the
+ * call stack of the allocation. The stacks are kept in a table of their
+ * own, each with the samples still live and the samples ever taken, and
+ * the live samples in a hash table by address, which free consults.
+ *
+ * A sample of size bytes stands for size / (1 - exp(-size / N)) bytes of
+ * allocations, the estimate the folded output reports. The pprof output
+ * (heap_v2) leaves the raw counts and lets pprof do the scaling.
+ *
+ * The tables live in one mem_map region and hold at most HEAPPROF_STACKS
+ * stacks and HEAPPROF_SAMPLES live samples; samples that do not fit are
+ * dropped and counted. No routine here calls malloc.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "heapprof.h"
+#include "memlib.h"
+
+#define HEAPPROF_DEPTH   32            /* Frames recorded per stack */
+#define HEAPPROF_SKIP    12            /* Most allocator frames above a sample */
+#define HEAPPROF_STACKS  4096          /* Distinct stacks */
+#define HEAPPROF_SAMPLES (1 << 15)     /* Live samples */
+#define STACK_BUCKETS    4096
+
+/* Bounds of section heapprof_entry (HEAPPROF_ENTRY), set by the linker */
+extern char __start_heapprof_entry[] __attribute__((weak, visibility("hidden")));
+extern char __stop_heapprof_entry[] __attribute__((weak, visibility("hidden")));
+
+/* A distinct allocation call stack */
+struct stack {
+    struct stack *next;                /* Next stack in the hash chain */
+    uint64_t hash;
+    int depth;
+    size_t live_samples;               /* Samples not freed yet */
+    size_t live_bytes;                 /* ... their sizes */
+    size_t live_estimate;              /* ... the bytes they stand for */
+    size_t alloc_samples;              /* Samples ever taken */
+    size_t alloc_bytes;
+    void *pc[HEAPPROF_DEPTH];          /* Innermost frame first */
+};
+
+/* A sampled block that has not been freed */
+struct heapprof_sample {
+    struct heapprof_sample *next;      /* Next sample in the hash chain or free list */
+    char *p;
+    size_t size;
+    size_t estimate;                   /* Bytes of allocations it stands for */
+    struct stack *stack;
+};
+
+/* Everything the profiler keeps, in one mem_map region */
+struct tables {
+    struct heapprof_sample *buckets[HEAPPROF_BUCKETS];
+    struct stack *stack_buckets[STACK_BUCKETS];
+    struct stack stacks[HEAPPROF_STACKS];
+    struct heapprof_sample samples[HEAPPROF_SAMPLES];
+};
+
+/* Buffered output with a fixed buffer, so dumping does not allocate */
+struct out {
+    int fd;
+    size_t n;
+    char buf[4096];
+};
+
+/* Global variables */
+size_t heapprof_period;
+__thread long heapprof_left;
+struct heapprof_sample **heapprof_buckets;   /* Set once the tables exist */
+static struct tables *tables;
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;
+static int nstacks;                    /* Stacks in use */
+static int nsamples;                   /* Samples ever carved out of tables->samples */
+static struct heapprof_sample *free_samples;
+static size_t dropped;                 /* Samples the tables had no room for */
+static __thread uint64_t rng;          /* 0 until the thread draws its first interval */
+static __thread int busy;              /* Taking a sample, do not take another */
+
+/* Function prototypes for internal helper routines */
+static long next_interval(void);
+static struct stack *find_stack(void **pc, int depth);
+static void out_printf(struct out *o, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+static void out_flush(struct out *o);
+static void out_symbol(struct out *o, void *pc);
+
+/*
+ * heapprof_set_period - Sample about every period bytes, 0 to stop.
+ *    Returns 1 on success, 0 if the tables cannot be mapped.
+ */
+int heapprof_set_period(size_t period)
+{
+    void *pc[1];
+
+    if (period != 0 && tables == NULL) {
+        pthread_mutex_lock(&prof_lock);
+        if (tables == NULL && (tables = mem_map(sizeof(struct tables))) != NULL)
+            __atomic_store_n(&heapprof_buckets, tables->buckets, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&prof_lock);
+        if (tables == NULL)
+            return 0;
+        /* The first backtrace loads the unwinder, which allocates */
+        backtrace(pc, 1);
+    }
+    heapprof_period = period;
+    return 1;
+}
+
+/*
+ * heapprof_reset - Forget all samples and stacks, the heap they were
+ *    taken from is gone
+ */
+void heapprof_reset(void)
+{
+    pthread_mutex_lock(&prof_lock);
+    if (tables != NULL) {
+        memset(tables->buckets, 0, sizeof(tables->buckets));
+        memset(tables->stack_buckets, 0, sizeof(tables->stack_buckets));
+    }
+    nstacks = 0;
+    nsamples = 0;
+    free_samples = NULL;
+    dropped = 0;
+    pthread_mutex_unlock(&prof_lock);
+}
+
+/*
+ * heapprof_sample - Called by HEAPPROF_ALLOC when this thread's countdown
+ *    runs out: record block p of size bytes, allocated from here
+ */
+void heapprof_sample(void *p, size_t size)
+{
+    void *pc[HEAPPROF_SKIP + HEAPPROF_DEPTH];
+    size_t period = heapprof_period;
+    struct heapprof_sample *s;
+    struct stack *st;
+    unsigned int h;
+    int n, i, skip, depth;
+
+    if (rng == 0) {
+        /* The thread's first countdown starts here */
+        rng = ((uint64_t)(uintptr_t)&rng ^ (uint64_t)time(NULL)) | 1;
+        if ((heapprof_left += next_interval()) >= 0)
+            return;
+    }
+    heapprof_left = next_interval();
+    if (busy || period == 0)
+        return;                        /* The unwinder allocating, or profiling was stopped */
+
+    /* Drop the allocator's frames: this routine's own and every one up to
+     * the outermost public allocation routine. A frame's pc is a return
+     * address, so pc - 1 is inside the call. */
+    busy = 1;
+    n = backtrace(pc, HEAPPROF_SKIP + HEAPPROF_DEPTH);
+    busy = 0;
+    skip = 1;
+    for (i = 1; i < n && i < HEAPPROF_SKIP; i++)
+        if ((char *)pc[i] - 1 >= __start_heapprof_entry &&
+            (char *)pc[i] - 1 < __stop_heapprof_entry)
+            skip = i + 1;
+    depth = n - skip < HEAPPROF_DEPTH ? n - skip : HEAPPROF_DEPTH;
+    if (depth < 1)
+        return;
+
+    pthread_mutex_lock(&prof_lock);
+    if ((st = find_stack(pc + skip, depth)) == NULL) {
+        dropped++;
+        pthread_mutex_unlock(&prof_lock);
+        return;
+    }
+    if ((s = free_samples) != NULL)
+        free_samples = s->next;
+    else if (nsamples < HEAPPROF_SAMPLES)
+        s = &tables->samples[nsamples++];
+    else {
+        dropped++;
+        pthread_mutex_unlock(&prof_lock);
+        return;
+    }
+    s->p = p;
+    s->size = size;
+    s->estimate = (size_t)(size / -expm1(-(double)size / period));
+    s->stack = st;
+    st->live_samples++;
+    st->live_bytes += size;
+    st->live_estimate += s->estimate;
+    st->alloc_samples++;
+    st->alloc_bytes += size;
+
+    /* Published last, free may look at the chain without the lock */
+    h = HEAPPROF_HASH(p);
+    s->next = tables->buckets[h];
+    __atomic_store_n(&tables->buckets[h], s, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&prof_lock);
+}
+
+/*
+ * heapprof_unsample - Called by HEAPPROF_FREE when p may be sampled:
+ *    the block is freed, drop its sample
+ */
+void heapprof_unsample(void *p)
+{
+    struct heapprof_sample *s, **link;
+
+    pthread_mutex_lock(&prof_lock);
+    for (link = &tables->buckets[HEAPPROF_HASH(p)]; (s = *link) != NULL; link = &s->next) {
+        if (s->p == p) {
+            __atomic_store_n(link, s->next, __ATOMIC_RELAXED);
+            s->stack->live_samples--;
+            s->stack->live_bytes -= s->size;
+            s->stack->live_estimate -= s->estimate;
+            s->next = free_samples;
+            free_samples = s;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&prof_lock);
+}
+
+/*
+ * heapprof_totals - Live samples and the bytes they stand for
+ */
+void heapprof_totals(size_t *samples, size_t *bytes)
+{
+    int i;
+
+    *samples = *bytes = 0;
+    pthread_mutex_lock(&prof_lock);
+    for (i = 0; i < nstacks; i++) {
+        *samples += tables->stacks[i].live_samples;
+        *bytes += tables->stacks[i].live_estimate;
+    }
+    pthread_mutex_unlock(&prof_lock);
+}
+
+/*
+ * heapprof_dump - Write the stacks holding live samples to file
+ *    descriptor fd, either in the text heap profile format pprof reads
+ *    (heap_v2, followed by the memory map to symbolize with) or, if
+ *    folded, one line per stack for flame graph tools: the frames from
+ *    the outermost in, separated by ';', and the estimated live bytes.
+ */
+void heapprof_dump(int fd, int folded)
+{
+    struct out o = { .fd = fd };
+    size_t live_n = 0, live_b = 0, alloc_n = 0, alloc_b = 0;
+    struct stack *st;
+    ssize_t len;
+    int i, j, mfd;
+
+    pthread_mutex_lock(&prof_lock);
+    if (folded) {
+        for (i = 0; i < nstacks; i++) {
+            st = &tables->stacks[i];
+            if (st->live_samples == 0)
+                continue;
+            for (j = st->depth - 1; j >= 0; j--) {
+                out_symbol(&o, st->pc[j]);
+                out_printf(&o, "%s", j > 0 ? ";" : "");
+            }
+            out_printf(&o, " %zu\n", st->live_estimate);
+        }
+        pthread_mutex_unlock(&prof_lock);
+        out_flush(&o);
+        return;
+    }
+
+    for (i = 0; i < nstacks; i++) {
+        st = &tables->stacks[i];
+        live_n += st->live_samples;
+        live_b += st->live_bytes;
+        alloc_n += st->alloc_samples;
+        alloc_b += st->alloc_bytes;
+    }
+    out_printf(&o, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+               live_n, live_b, alloc_n, alloc_b, heapprof_period);
+    for (i = 0; i < nstacks; i++) {
+        st = &tables->stacks[i];
+        out_printf(&o, "%zu: %zu [%zu: %zu] @", st->live_samples, st->live_bytes,
+                   st->alloc_samples, st->alloc_bytes);
+        for (j = 0; j < st->depth; j++)
+            out_printf(&o, " %p", st->pc[j]);
+        out_printf(&o, "\n");
+    }
+    pthread_mutex_unlock(&prof_lock);
+
+    out_printf(&o, "\nMAPPED_LIBRARIES:\n");
+    out_flush(&o);
+    if ((mfd = open("/proc/self/maps", O_RDONLY)) >= 0) {
+        while ((len = read(mfd, o.buf, sizeof(o.buf))) > 0) {
+            o.n = len;
+            out_flush(&o);
+        }
+        close(mfd);
+    }
+}
+
+/*
+ * heapprof_lock - Take the profiler lock, for fork. heapprof_unlock releases it.
+ */
+void heapprof_lock(void)
+{
+    pthread_mutex_lock(&prof_lock);
+}
+
+void heapprof_unlock(void)
+{
+    pthread_mutex_unlock(&prof_lock);
+}
+
+/*
+ * The remaining routines are internal helper routines
+ */
+
+/*
+ * next_interval - Bytes until this thread's next sample, exponentially
+ *    distributed with mean heapprof_period
+ */
+static long next_interval(void)
+{
+    double u;
+
+    /* xorshift64 */
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    u = ((rng >> 11) + 1) * 0x1p-53;   /* In (0, 1] */
+    return (long)(-log(u) * heapprof_period);
+}
+
+/*
+ * find_stack - The stack of depth frames pc, added to the table if it is
+ *    new. Returns NULL if the table is full. Called with prof_lock held.
+ */
+static struct stack *find_stack(void **pc, int depth)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;     /* FNV-1a over the frames */
+    struct stack *st;
+    unsigned int b;
+    int i;
+
+    for (i = 0; i < depth; i++)
+        hash = (hash ^ (uintptr_t)pc[i]) * 0x100000001b3ULL;
+    b = hash % STACK_BUCKETS;
+    for (st = tables->stack_buckets[b]; st != NULL; st = st->next)
+        if (st->hash == hash && st->depth == depth &&
+            memcmp(st->pc, pc, depth * sizeof(void *)) == 0)
+            return st;
+
+    if (nstacks == HEAPPROF_STACKS)
+        return NULL;
+    st = &tables->stacks[nstacks++];
+    memset(st, 0, sizeof(*st));
+    st->hash = hash;
+    st->depth = depth;
+    memcpy(st->pc, pc, depth * sizeof(void *));
+    st->next = tables->stack_buckets[b];
+    tables->stack_buckets[b] = st;
+    return st;
+}
+
+/*
+ * out_printf - printf into o, writing o out when it fills up
+ */
+static void out_printf(struct out *o, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(o->buf + o->n, sizeof(o->buf) - o->n, fmt, ap);
+    va_end(ap);
+    if (n >= 0 && (size_t)n >= sizeof(o->buf) - o->n) {
+        /* Did not fit: write out what is there and try again */
+        out_flush(o);
+        va_start(ap, fmt);
+        n = vsnprintf(o->buf, sizeof(o->buf), fmt, ap);
+        va_end(ap);
+        if ((size_t)n >= sizeof(o->buf))
+            n = sizeof(o->buf) - 1;    /* Truncated */
+    }
+    if (n > 0)
+        o->n += n;
+}
+
+static void out_flush(struct out *o)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < o->n && (n = write(o->fd, o->buf + done, o->n - done)) > 0)
+        done += n;
+    o->n = 0;
+}
+
+/*
+ * out_symbol - The function pc is in, or its object file and offset if
+ *    the function is not exported, or just the address
+ */
+static void out_symbol(struct out *o, void *pc)
+{
+    Dl_info info;
+    const char *file;
+
+    if (dladdr(pc, &info) == 0 || info.dli_fname == NULL) {
+        out_printf(o, "%p", pc);
+    } else if (info.dli_sname != NULL) {
+        out_printf(o, "%s", info.dli_sname);
+    } else {
+        file = strrchr(info.dli_fname, '/');
+        out_printf(o, "%s+%#lx", file ? file + 1 : info.dli_fname,
+                   (unsigned long)((char *)pc - (char *)info.dli_fbase));
+    }
+}
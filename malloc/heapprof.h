@@ -0,0 +1,44 @@
+/* $begin heapprofheader */
+#include <stddef.h>
+#include <stdint.h>
+
+/* Live samples are hashed by address into HEAPPROF_BUCKETS chains */
+#define HEAPPROF_BUCKETS (1 << 14)
+#define HEAPPROF_HASH(p) \
+    ((unsigned int)((((uintptr_t)(p) >> 3) * 0x9e3779b97f4a7c15ULL) >> (64 - 14)))
+
+struct heapprof_sample;
+
+/* Marks the allocator's public allocation routines, and the routine that
+ * calls HEAPPROF_ALLOC, which they may reach by tail calls that leave no
+ * frame of their own. They all live in one section, and the frames of a
+ * sampled stack up to the outermost one of them are the allocator's own,
+ * not the caller's. */
+#define HEAPPROF_ENTRY __attribute__((section("heapprof_entry")))
+
+/* Sampling period in bytes, 0 when the profiler is off. Each thread
+ * counts heapprof_left down and samples the allocation that takes it
+ * below 0. */
+extern size_t heapprof_period;
+extern __thread long heapprof_left;
+extern struct heapprof_sample **heapprof_buckets;
+
+/* Fast paths, called on every allocation and free: a load and a branch
+ * unless p is sampled, or shares its hash chain with a sample */
+#define HEAPPROF_ALLOC(p, size) \
+    do { if (heapprof_period != 0 && (heapprof_left -= (long)(size)) < 0) \
+             heapprof_sample(p, size); } while (0)
+#define HEAPPROF_FREE(p) \
+    do { struct heapprof_sample **b_ = __atomic_load_n(&heapprof_buckets, __ATOMIC_ACQUIRE); \
+         if (b_ != NULL && __atomic_load_n(&b_[HEAPPROF_HASH(p)], __ATOMIC_RELAXED) != NULL) \
+             heapprof_unsample(p); } while (0)
+
+int heapprof_set_period(size_t period);
+void heapprof_reset(void);
+void heapprof_sample(void *p, size_t size);
+void heapprof_unsample(void *p);
+void heapprof_totals(size_t *samples, size_t *bytes);
+void heapprof_dump(int fd, int folded);
+void heapprof_lock(void);
+void heapprof_unlock(void);
+/* $end heapprofheader */
@@ -4,6 +4,7 @@
  * package with the system's malloc package in libc.
  *
  */
+#define _GNU_SOURCE /* mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -11,60 +12,406 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include "memlib.h"
 
-#define MAX_HEAP 1024 * 1024  /* 1 MB */
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
 
+/* A heap file starts with MEM_FILE_HDR bytes of header, the heaps follow.
+ * The allocator's part of the header starts at MEM_ROOT_OFF. */
+#define MEM_FILE_HDR (64 * 1024)
+#define MEM_ROOT_OFF (MEM_FILE_HDR - MEM_ROOT_SIZE)
+#define MEM_FILE_MAGIC 0x6d656d6c69623031UL
+
+/* memlib's part of the header of a heap file */
+struct mem_file_header {
+    unsigned long magic;        /* MEM_FILE_MAGIC once the file holds heaps */
+    char *base;                 /* Address the file is mapped at */
+    int heap_shift;             /* log2 of the bytes reserved per heap */
+    int clean;                  /* Closed by mem_deinit, not left behind by a crash */
+    size_t brk[MEM_MAX_HEAPS];  /* Bytes in use of each heap */
+};
 
 /* $begin memlib */
 /* Private global variables */
-static char *mem_heap;     /* Points to first byte of heap */ 
-static char *mem_brk;      /* Points to last byte of heap plus 1 */
-static char *mem_max_addr; /* Max legal heap addr plus 1*/ 
+static char *mem_heap;                  /* Points to first byte of heap 0 */ 
+static char *mem_brk[MEM_MAX_HEAPS];    /* Last byte of each heap plus 1 */
+static char *mem_committed[MEM_MAX_HEAPS]; /* End of the read/write part of each heap */
+static char *mem_max_addr;              /* Max legal heap addr plus 1*/ 
+static size_t mem_max_heap = MEM_DEFAULT_MAX_HEAP; /* Bytes reserved per heap */
+static int mem_heap_shift = 30;         /* log2(mem_max_heap) */
+static const char *mem_file_path;       /* File backing the heaps, NULL for none */
+static char *mem_file_base = MEM_FILE_DEFAULT_BASE; /* Where a new heap file is mapped */
+static struct mem_file_header *mem_file; /* Header of the mapped heap file */
+static int mem_fd = -1;
+static int mem_huge;                    /* Heaps use transparent huge pages */
+
+static void mem_init_file(void);
+static int mem_discard(void *p, size_t size);
+
+/* Heap i occupies [mem_heap + i*mem_max_heap, mem_heap + (i+1)*mem_max_heap) */
+#define HEAP_START(i) (mem_heap + ((size_t)(i) << mem_heap_shift))
+
+/*
+ * mem_set_max_heap - Set the most bytes a single heap may grow to, rounded
+ *    up to a power of two. Only allowed before mem_init. Returns 1 on
+ *    success and 0 on failure.
+ */
+int mem_set_max_heap(size_t size)
+{
+    int shift = 12;
+
+    if (mem_heap != NULL || size == 0)
+        return 0;
+    while (((size_t)1 << shift) < size) {
+        if (shift == 8 * sizeof(size_t) - 1)
+            return 0;
+        shift++;
+    }
+    mem_heap_shift = shift;
+    mem_max_heap = (size_t)1 << shift;
+    return 1;
+}
+
+/*
+ * mem_set_file - Back the heaps with the file at path, mapped at address
+ *    base, or MEM_FILE_DEFAULT_BASE for NULL, so that they outlive the
+ *    process; NULL path goes back to anonymous memory. Only allowed before
+ *    mem_init, and path must stay valid until then. The mapping is shared,
+ *    so a forked child must not allocate before it execs. Returns 1 on
+ *    success and 0 on failure.
+ */
+int mem_set_file(const char *path, void *base)
+{
+    if (mem_heap != NULL || (path != NULL && mem_huge))
+        return 0;
+    mem_file_path = path;
+    mem_file_base = base ? base : MEM_FILE_DEFAULT_BASE;
+    return 1;
+}
+
+/*
+ * mem_set_hugepages - Back the heaps with transparent huge pages: they are
+ *    madvised MADV_HUGEPAGE, and commit and give back memory MEM_HUGE_PAGE
+ *    bytes at a time, so that no huge page is left half committed or split
+ *    by a release. Only allowed before mem_init, and not with a heap file.
+ *    Returns 1 on success and 0 on failure.
+ */
+int mem_set_hugepages(int on)
+{
+    if (mem_heap != NULL || (on && mem_file_path != NULL))
+        return 0;
+    mem_huge = on;
+    return 1;
+}
 
 /* 
- * mem_init - Initialize the memory system model
+ * mem_init - Initialize the memory system model. Address space for all
+ *    heaps is reserved up front but not accessible; mem_sbrk commits
+ *    pages as the heaps grow, so only what is used costs memory. The
+ *    reservation is MEM_HUGE_PAGE aligned, so that huge pages can back
+ *    the heaps from their first byte.
  */
 void mem_init(void)
 {
-    mem_heap = (char *)malloc(MAX_HEAP);
-    mem_brk = (char *)mem_heap;               
-    mem_max_addr = (char *)(mem_heap + MAX_HEAP); 
+    size_t size = (size_t)MEM_MAX_HEAPS << mem_heap_shift;
+    char *p, *start;
+    int i;
+
+    if (mem_file_path != NULL) {
+        mem_init_file();
+        return;
+    }
+    p = mmap(NULL, size + MEM_HUGE_PAGE, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "ERROR: mem_init failed to reserve %zu bytes: %s\n",
+                size, strerror(errno));
+        mem_heap = NULL;
+        return;
+    }
+    /* Cut the reservation down to an aligned one */
+    start = (char *)(((uintptr_t)p + MEM_HUGE_PAGE - 1) & ~(MEM_HUGE_PAGE - 1));
+    if (start > p)
+        munmap(p, start - p);
+    munmap(start + size, p + MEM_HUGE_PAGE - start);
+    mem_heap = start;
+    if (mem_huge)
+        madvise(mem_heap, size, MADV_HUGEPAGE);
+    mem_max_addr = HEAP_START(MEM_MAX_HEAPS);
+    for (i = 0; i < MEM_MAX_HEAPS; i++)
+        mem_committed[i] = HEAP_START(i);
+    mem_reset_brk();
+}
+
+/*
+ * mem_init_file - mem_init for heaps in the file mem_file_path. A file
+ *    that mem_deinit closed is mapped back at the address it was created
+ *    at, with every heap as it was and the header's root area intact.
+ *    Any other file, including one left behind by a crash, is emptied and
+ *    starts out with empty heaps and a zeroed root area.
+ */
+static void mem_init_file(void)
+{
+    struct mem_file_header hdr;
+    size_t size, pagesize = mem_pagesize();
+    char *base, *p;
+    int i, attach;
+
+    if ((mem_fd = open(mem_file_path, O_RDWR | O_CREAT, 0600)) < 0) {
+        fprintf(stderr, "ERROR: mem_init cannot open %s: %s\n",
+                mem_file_path, strerror(errno));
+        return;
+    }
+    attach = pread(mem_fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+             hdr.magic == MEM_FILE_MAGIC && hdr.clean;
+    if (attach) {
+        mem_heap_shift = hdr.heap_shift;
+        mem_max_heap = (size_t)1 << mem_heap_shift;
+        base = hdr.base;
+    } else {
+        base = mem_file_base;
+    }
+    size = MEM_FILE_HDR + ((size_t)MEM_MAX_HEAPS << mem_heap_shift);
+
+    /* The file is sparse: only the pages the heaps use take disk space */
+    if (!attach && (ftruncate(mem_fd, 0) < 0 || ftruncate(mem_fd, size) < 0)) {
+        fprintf(stderr, "ERROR: mem_init cannot size %s: %s\n",
+                mem_file_path, strerror(errno));
+        goto fail;
+    }
+    p = mmap(base, size, PROT_NONE, MAP_SHARED | MAP_NORESERVE | MAP_FIXED_NOREPLACE,
+             mem_fd, 0);
+    if (p != MAP_FAILED && p != base) {
+        /* A kernel without MAP_FIXED_NOREPLACE took it as a hint */
+        munmap(p, size);
+        p = MAP_FAILED;
+        errno = EEXIST;
+    }
+    if (p == MAP_FAILED || mprotect(p, MEM_FILE_HDR, PROT_READ | PROT_WRITE) < 0) {
+        fprintf(stderr, "ERROR: mem_init cannot map %s at %p: %s\n",
+                mem_file_path, base, strerror(errno));
+        goto fail;
+    }
+
+    mem_file = (struct mem_file_header *)p;
+    mem_heap = p + MEM_FILE_HDR;
+    mem_max_addr = HEAP_START(MEM_MAX_HEAPS);
+    for (i = 0; i < MEM_MAX_HEAPS; i++) {
+        mem_brk[i] = HEAP_START(i) + (attach ? mem_file->brk[i] : 0);
+        mem_committed[i] = HEAP_START(i) +
+            ((mem_brk[i] - HEAP_START(i) + pagesize - 1) & ~(pagesize - 1));
+        if (mem_committed[i] > HEAP_START(i))
+            mprotect(HEAP_START(i), mem_committed[i] - HEAP_START(i),
+                     PROT_READ | PROT_WRITE);
+    }
+    if (!attach) {
+        mem_file->magic = MEM_FILE_MAGIC;
+        mem_file->base = p;
+        mem_file->heap_shift = mem_heap_shift;
+    }
+    mem_file->clean = 0; /* Until mem_deinit */
+    return;
+
+fail:
+    close(mem_fd);
+    mem_fd = -1;
+}
+
+/*
+ * mem_file_root - return the MEM_ROOT_SIZE bytes of the heap file's header
+ *    that are the allocator's, or NULL if the heaps are not in a file
+ */
+void *mem_file_root(void)
+{
+    return mem_file ? (char *)mem_file + MEM_ROOT_OFF : NULL;
 }
 
 /* 
- * mem_sbrk - Simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ * mem_sbrk - Simple model of the sbrk function. Extends heap 0
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap and returns its pages to the OS.
  */
-void *mem_sbrk(int incr) 
+void *mem_sbrk(intptr_t incr) 
 {
-    char *old_brk = mem_brk;
+    return mem_heap_sbrk(0, incr);
+}
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+/*
+ * mem_heap_sbrk - mem_sbrk for one of the MEM_MAX_HEAPS heaps. Heaps are
+ *    independent, so callers only need to serialize calls on the same heap.
+ */
+void *mem_heap_sbrk(int heap, intptr_t incr)
+{
+    char *old_brk = mem_brk[heap];
+    char *new_brk = old_brk + incr;
+    size_t unit = mem_commit_unit();
+    char *end;
+
+    if (mem_heap == NULL || incr < -(old_brk - HEAP_START(heap)) ||
+        incr > HEAP_START(heap + 1) - old_brk) {
         errno = ENOMEM;
         fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
         return (void *)-1;
     }
-    mem_brk += incr;
+    /* First commit unit boundary at or above the new brk */
+    end = mem_heap + (((new_brk - mem_heap) + unit - 1) & ~(unit - 1));
+    if (end > HEAP_START(heap + 1))
+        end = HEAP_START(heap + 1);
+    if (end < mem_committed[heap]) {
+        /* Shrinking: drop the pages past the new brk. If they cannot be
+         * dropped the heap keeps them and stays where it was; if they only
+         * cannot be made inaccessible they stay committed, reading as zero. */
+        if (mem_discard(end, mem_committed[heap] - end) < 0) {
+            fprintf(stderr, "ERROR: mem_sbrk failed. Cannot release memory: %s\n",
+                    strerror(errno));
+            return (void *)-1;
+        }
+        if (mprotect(end, mem_committed[heap] - end, PROT_NONE) == 0)
+            mem_committed[heap] = end;
+    }
+    if (new_brk > mem_committed[heap]) {
+        /* Make the pages up to the new brk accessible */
+        if (mprotect(mem_committed[heap], end - mem_committed[heap],
+                     PROT_READ | PROT_WRITE) < 0) {
+            fprintf(stderr, "ERROR: mem_sbrk failed. Cannot commit memory: %s\n",
+                    strerror(errno));
+            return (void *)-1;
+        }
+        mem_committed[heap] = end;
+    }
+    mem_brk[heap] = new_brk;
     return (void *)old_brk;
 }
 /* $end memlib */
 
+/*
+ * mem_release - give the whole pages inside [lo, hi) back to the OS, whole
+ *    huge pages with mem_set_hugepages. They stay accessible and read as
+ *    zeros when next touched. Returns the number of bytes that were
+ *    resident and are now released.
+ */
+size_t mem_release(void *lo, void *hi)
+{
+    size_t pagesize = mem_pagesize();
+    size_t unit = mem_commit_unit();
+    uintptr_t start = ((uintptr_t)lo + unit - 1) & ~(unit - 1);
+    uintptr_t end = (uintptr_t)hi & ~(unit - 1);
+    unsigned char vec[1024];
+    size_t released = 0, resident, chunk, i;
+
+    /* Only count (and bother with) the pages that are actually resident */
+    for ( ; start < end; start += chunk) {
+        chunk = end - start;
+        if (chunk > sizeof(vec) * pagesize)
+            chunk = sizeof(vec) * pagesize;
+        if (mincore((void *)start, chunk, vec) < 0)
+            continue;
+        resident = 0;
+        for (i = 0; i < chunk / pagesize; i++)
+            resident += vec[i] & 1;
+        if (resident > 0 && mem_discard((void *)start, chunk) == 0)
+            released += resident * pagesize;
+    }
+    return released;
+}
+
+/*
+ * mem_discard - drop the pages of [p, p + size) so that they read as zeros.
+ *    In a heap file this frees their disk blocks too; there MADV_DONTNEED
+ *    would only drop them from this mapping. Returns 0 on success.
+ */
+static int mem_discard(void *p, size_t size)
+{
+    return madvise(p, size, mem_file ? MADV_REMOVE : MADV_DONTNEED);
+}
+
+/*
+ * mem_commit_unit - the granule the heaps commit and release memory in.
+ *    A heap that shrinks keeps its memory up to the next multiple of it.
+ */
+size_t mem_commit_unit(void)
+{
+    return mem_huge ? MEM_HUGE_PAGE : mem_pagesize();
+}
+
+/*
+ * mem_map - map size bytes of fresh zeroed memory outside the heaps.
+ *    Returns NULL on failure.
+ */
+void *mem_map(size_t size)
+{
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    return (p == MAP_FAILED) ? NULL : p;
+}
+
+/*
+ * mem_remap - resize a mem_map region, moving it if it cannot grow in
+ *    place. Pages are moved, not copied. Returns NULL on failure.
+ */
+void *mem_remap(void *p, size_t old_size, size_t new_size)
+{
+    p = mremap(p, old_size, new_size, MREMAP_MAYMOVE);
+    return (p == MAP_FAILED) ? NULL : p;
+}
+
+/*
+ * mem_unmap - unmap a mem_map region
+ */
+void mem_unmap(void *p, size_t size)
+{
+    munmap(p, size);
+}
+
+/*
+ * mem_heap_id - return the heap that address p belongs to, or -1
+ */
+int mem_heap_id(void *p)
+{
+    if ((char *)p < mem_heap || (char *)p >= mem_max_addr)
+        return -1;
+    return (int)(((char *)p - mem_heap) >> mem_heap_shift);
+}
+
 /* 
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void)
 {
-    free(mem_heap);
+    int i;
+
+    if (mem_file != NULL) {
+        /* Write everything out, then mark the file as safe to reattach to */
+        for (i = 0; i < MEM_MAX_HEAPS; i++)
+            mem_file->brk[i] = mem_brk[i] - HEAP_START(i);
+        msync(mem_file, MEM_FILE_HDR + ((size_t)MEM_MAX_HEAPS << mem_heap_shift), MS_SYNC);
+        mem_file->clean = 1;
+        msync(mem_file, MEM_FILE_HDR, MS_SYNC);
+        munmap(mem_file, MEM_FILE_HDR + ((size_t)MEM_MAX_HEAPS << mem_heap_shift));
+        close(mem_fd);
+        mem_file = NULL;
+        mem_fd = -1;
+        mem_heap = NULL;
+        return;
+    }
+    if (mem_heap != NULL)
+        munmap(mem_heap, (size_t)MEM_MAX_HEAPS << mem_heap_shift);
+    mem_heap = NULL;
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointers to make empty heaps
  */
 void mem_reset_brk()
 {
-    mem_brk = (char *)mem_heap;
+    int i;
+
+    for (i = 0; i < MEM_MAX_HEAPS; i++)
+        mem_brk[i] = HEAP_START(i);
 }
 
 /*
@@ -76,19 +423,82 @@ void *mem_heap_lo()
 }
 
 /* 
- * mem_heap_hi - return address of last heap byte
+ * mem_heap_hi - return address of last byte of heap 0
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return (void *)(mem_brk[0] - 1);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heapsize() - returns the total size of all heaps in bytes
  */
 size_t mem_heapsize() 
 {
-    return (size_t)((void *)mem_brk - (void *)mem_heap);
+    size_t size = 0;
+    int i;
+
+    for (i = 0; i < MEM_MAX_HEAPS; i++)
+        size += (size_t)(mem_brk[i] - HEAP_START(i));
+    return size;
+}
+
+/*
+ * mem_in_use - bytes of [lo, hi) below the brk of their heap
+ */
+static size_t mem_in_use(char *lo, char *hi)
+{
+    size_t bytes = 0;
+    char *start, *end;
+    int i;
+
+    for (i = 0; i < MEM_MAX_HEAPS; i++) {
+        start = HEAP_START(i) > lo ? HEAP_START(i) : lo;
+        end = mem_brk[i] < hi ? mem_brk[i] : hi;
+        if (end > start)
+            bytes += end - start;
+    }
+    return bytes;
+}
+
+/*
+ * mem_huge_bytes() - returns the bytes of the heaps backed by transparent
+ *    huge pages, as /proc/self/smaps counts them, or 0 if it cannot be
+ *    read. smaps counts whole mappings, which take in the memory committed
+ *    past each brk, so a mapping counts for at most its bytes below the
+ *    brks. Reads the file with plain read calls, so that it does not
+ *    allocate from the heaps it looks at.
+ */
+size_t mem_huge_bytes(void)
+{
+    char buf[4096], *line, *nl;
+    size_t len = 0, total = 0, huge, in_use = 0;
+    unsigned long lo, hi;
+    ssize_t n;
+    int fd;
+
+    if (mem_heap == NULL || (fd = open("/proc/self/smaps", O_RDONLY)) < 0)
+        return 0;
+    while ((n = read(fd, buf + len, sizeof(buf) - 1 - len)) > 0) {
+        len += n;
+        buf[len] = '\0';
+        for (line = buf; (nl = strchr(line, '\n')) != NULL; line = nl + 1) {
+            *nl = '\0';
+            /* A mapping starts with its address range, its fields follow */
+            if (sscanf(line, "%lx-%lx ", &lo, &hi) == 2) {
+                in_use = mem_in_use((char *)lo, (char *)hi);
+            } else if (in_use > 0 && strncmp(line, "AnonHugePages:", 14) == 0) {
+                huge = strtoul(line + 14, NULL, 10) * 1024;
+                total += huge < in_use ? huge : in_use;
+            }
+        }
+        len -= line - buf;
+        memmove(buf, line, len);
+        if (len == sizeof(buf) - 1)
+            len = 0;             /* A line too long to hold: skip it */
+    }
+    close(fd);
+    return total;
 }
 
 /*
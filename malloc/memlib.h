@@ -1,8 +1,25 @@
 /* $begin memlibheader */
 #include <unistd.h>
+#include <stdint.h>
 
+#define MEM_MAX_HEAPS 16 /* Independent heaps, each with its own brk */
+#define MEM_DEFAULT_MAX_HEAP (1UL << 30) /* Address space reserved per heap */
+#define MEM_FILE_DEFAULT_BASE ((void *)0x300000000000UL) /* Where heap files are mapped */
+#define MEM_ROOT_SIZE (60 * 1024) /* Bytes of a heap file's header kept for the allocator */
+#define MEM_HUGE_PAGE (2UL << 20) /* Transparent huge page size, and alignment of the heaps */
+
+int mem_set_max_heap(size_t size);
+int mem_set_file(const char *path, void *base);
+int mem_set_hugepages(int on);
 void mem_init(void);               
-void *mem_sbrk(int incr);
+void *mem_file_root(void);
+void *mem_sbrk(intptr_t incr);
+void *mem_heap_sbrk(int heap, intptr_t incr);
+int mem_heap_id(void *p);
+size_t mem_release(void *lo, void *hi);
+void *mem_map(size_t size);
+void *mem_remap(void *p, size_t old_size, size_t new_size);
+void mem_unmap(void *p, size_t size);
 
 void mem_deinit(void);
 void mem_reset_brk(void); 
@@ -10,5 +27,7 @@ void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+size_t mem_commit_unit(void);
+size_t mem_huge_bytes(void);
 /* $end memlibheader */
 
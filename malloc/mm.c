@@ -2,32 +2,118 @@
  * Simple, 32-bit and 64-bit clean allocator based on implicit free
  * lists, first-fit placement, and boundary tag coalescing, as described
  * in the CS:APP3e text. Blocks must be aligned to doubleword (8 byte) 
- * boundaries. Minimum block size is 16 bytes. 
+ * boundaries. Minimum block size is 24 bytes. 
+ *
+ * Headers and footers are 4-byte words, which limits a block, and so an
+ * arena's heap, to 4 GB. Built with -DWIDE_HEADERS=1 they are 8 bytes
+ * and blocks are aligned to 16 bytes and at least 32 bytes long, for
+ * heaps beyond that; set MM_HEAP_MAX to let them grow.
+ *
+ * Headers also record whether the previous block is allocated, so
+ * coalescing never reads the footer of an allocated block. Built with
+ * -DALLOC_FOOTERS=0, allocated blocks have no footer at all and only
+ * free blocks keep one, which saves a word per allocated block.
+ *
+ * Free blocks are also linked into an explicit free list, or, in
+ * segregated fit mode, into one list per power-of-two size class, or, in
+ * best fit mode, into a splay tree ordered by block size and address. The
+ * next fit and address-ordered first fit modes keep them in a splay tree
+ * ordered by address alone, which they walk in address order from a
+ * rover, or from the bottom of the heap.
+ *
+ * Memory is split into arenas. Each arena grows its own memlib heap, has
+ * its own free lists and its own lock, and threads are spread over the
+ * arenas round-robin. A block is always freed back to the arena whose
+ * heap contains it. A thread freeing a block of another thread's arena
+ * does not take that arena's lock; it pushes the block onto the arena's
+ * lock-free remote free list, which the owner drains on its next malloc.
+ * Each thread also keeps a small cache of blocks it freed (tcache), so
+ * most malloc/free pairs of small sizes never touch a lock or the free
+ * lists.
+ *
+ * With MM_QUICK_MAX set, blocks of up to that size that reach an arena are
+ * not coalesced when freed. They wait, still marked allocated, on one
+ * LIFO quick list per size, where a malloc of the same size finds them
+ * without splitting anything. A consolidation pass frees them for real
+ * once the quick lists hold too many bytes, or when a malloc finds no
+ * fit otherwise.
+ *
+ * Requests of at least the mmap threshold bypass the arenas: each gets
+ * its own mmap region, which is unmapped on free and resized with
+ * mremap on realloc. Requests of at most the slab size are served by the
+ * slab allocator in slab.c, without any header or footer.
+ *
+ * When memlib keeps the heaps in a file (mem_set_file), every block comes
+ * from the arenas, and mm_persist saves their heap pointers and free list
+ * roots, with a root object for the application, in the file's header.
+ * The next mm_init on that file takes them up again, so the heap is back
+ * as it was without walking or rebuilding anything.
+ *
+ * With MM_HUGEPAGES set, memlib madvises the heaps for transparent huge
+ * pages and commits and releases their memory 2 MB at a time, so that
+ * the kernel can back them with huge pages from the first fault on;
+ * mm_stats reports how much of the heaps it did.
+ *
+ * With MM_PROFILE_PERIOD set, allocations are sampled about every that
+ * many bytes by the heap profiler in heapprof.c, and mm_profile_dump
+ * reports the call stacks holding live memory.
  */
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
 
+#ifdef FIT_MODE
+#include "mm_names.h"
+#endif
 #include "mm.h"
 #include "memlib.h"
-
-int fit_mode = 0; // 0: first, 1: next, 2: best
+#include "slab.h"
+#include "heapprof.h"
+
+/* Built with -DFIT_MODE=n the placement policy is fixed: every fit_mode
+ * test folds to a constant and the code of the other policies drops out.
+ * mm_fit0.c to mm_fit4.c are those builds, and mm_dispatch.c picks one at
+ * mm_init. */
+#ifdef FIT_MODE
+#define fit_mode FIT_MODE
+#else
+int fit_mode = 0; // 0: first, 1: next, 2: best, 3: segregated, 4: address-ordered first
+#endif
 
 /* $begin mallocmacros */
+/* Set to 1 for 8-byte headers and footers and 16-byte alignment, so that
+ * a single block can be larger than 4 GB */
+#ifndef WIDE_HEADERS
+#define WIDE_HEADERS 0
+#endif
+
 /* Basic constants and macros */
+#if WIDE_HEADERS
+#define WSIZE       8       /* Word and header/footer size (bytes) */
+#define DSIZE       16      /* Double word size (bytes) */
+typedef size_t word_t;      /* Header/footer word */
+#else
 #define WSIZE       4       /* Word and header/footer size (bytes) */ //line:vm:mm:beginconst
 #define DSIZE       8       /* Double word size (bytes) */
+typedef unsigned int word_t;
+#endif
 #define CHUNKSIZE  (1<<12)  /* Extend heap by this amount (bytes) */  //line:vm:mm:endconst 
 
+/* Smallest block: a header, the two free list links and a footer, rounded
+ * up to the alignment */
+#define MIN_BLOCK  (DSIZE * ((2*WSIZE + 2*sizeof(char *) + DSIZE-1) / DSIZE))
+
 #define MAX(x, y) ((x) > (y)? (x) : (y))  
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)  ((size) | (alloc)) //line:vm:mm:pack
 
 /* Read and write a word at address p */
-#define GET(p)       (*(unsigned int *)(p))            //line:vm:mm:get
-#define PUT(p, val)  (*(unsigned int *)(p) = (val))    //line:vm:mm:put
+#define GET(p)       (*(word_t *)(p))                  //line:vm:mm:get
+#define PUT(p, val)  (*(word_t *)(p) = (val))          //line:vm:mm:put
 
 // Write a pointer to a word at address p */
 #define PUT_PTR(p, ptr) (*(char **)(p) = (char *)(ptr))
@@ -36,6 +122,27 @@ int fit_mode = 0; // 0: first, 1: next, 2: best
 #define GET_SIZE(p)  (GET(p) & ~0x7)                   //line:vm:mm:getsize
 #define GET_ALLOC(p) (GET(p) & 0x1)                    //line:vm:mm:getalloc
 
+/* Headers carry a bit telling whether the previous block is allocated */
+#define PREV_ALLOC          0x2
+#define GET_PREV_ALLOC(p)   (GET(p) & PREV_ALLOC)
+#define PUT_HDR(p, val)     PUT(p, (val) | GET_PREV_ALLOC(p)) /* Keeps the bit */
+#define SET_PREV_ALLOC(p)   PUT(p, GET(p) | PREV_ALLOC)
+#define CLEAR_PREV_ALLOC(p) PUT(p, GET(p) & ~PREV_ALLOC)
+
+/* Set to 0 to give allocated blocks no footer, only free blocks keep one */
+#ifndef ALLOC_FOOTERS
+#define ALLOC_FOOTERS 1
+#endif
+
+/* Bytes of an allocated block that are not payload */
+#define OVERHEAD (ALLOC_FOOTERS ? DSIZE : WSIZE)
+
+/* Largest request adjust_size can round up without wrapping */
+#define MAX_REQUEST (SIZE_MAX - OVERHEAD - DSIZE)
+
+/* Write the footer of an allocated block, if it has one */
+#define PUT_ALLOC_FTR(bp, val) do { if (ALLOC_FOOTERS) PUT(FTRP(bp), val); } while (0)
+
 /* Given block ptr bp, compute address of its header and footer */
 #define HDRP(bp)       ((char *)(bp) - WSIZE)                      //line:vm:mm:hdrp
 #define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE) //line:vm:mm:ftrp
@@ -51,179 +158,1428 @@ int fit_mode = 0; // 0: first, 1: next, 2: best
 /* Given block ptr bp, compute address of pred and succ blocks */
 #define GET_SUCC(bp) (*(SUCC_ADDR(bp)))
 #define GET_PRED(bp) (*(PRED_ADDR(bp)))
+
+/* Best fit keeps free blocks in a splay tree ordered by (size, address),
+ * next fit and address-ordered first fit in one ordered by address,
+ * reusing the pred/succ words as the left/right child pointers */
+#define ADDR_ORDERED (fit_mode == 1 || fit_mode == 4)
+#define USES_TREE    (fit_mode == 2 || ADDR_ORDERED)
+#define GET_LEFT(bp)       GET_PRED(bp)
+#define GET_RIGHT(bp)      GET_SUCC(bp)
+#define SET_LEFT(bp, ptr)  PUT_PTR(PRED_ADDR(bp), ptr)
+#define SET_RIGHT(bp, ptr) PUT_PTR(SUCC_ADDR(bp), ptr)
+
+/* Is the key (size, addr) ordered before block bp in the tree? */
+#define KEY_LESS(size, addr, bp) \
+    (ADDR_ORDERED ? (char *)(addr) < (char *)(bp) : \
+     ((size) < GET_SIZE(HDRP(bp)) || \
+      ((size) == GET_SIZE(HDRP(bp)) && (char *)(addr) < (char *)(bp))))
+
+/* Segregated fit: class 0 holds blocks up to 32 bytes, class k up to 32 << k */
+#define NUM_CLASSES MM_SIZE_CLASSES
+
+/* Per-thread cache: up to TCACHE_COUNT blocks of each size up to TCACHE_MAX_SIZE */
+#ifndef TCACHE_COUNT
+#define TCACHE_COUNT 16
+#endif
+#define TCACHE_MAX_SIZE 512
+#define TCACHE_BINS ((TCACHE_MAX_SIZE - MIN_BLOCK) / DSIZE + 1)
+#define TCACHE_IDX(size) (((size) - MIN_BLOCK) / DSIZE)
+
+/* Cached blocks stay allocated in the heap and are chained through their payload */
+#define GET_NEXT_CACHED(bp) (*(char **)(bp))
+
+/* Per-arena quick lists of freed blocks of up to QUICK_MAX_SIZE bytes, one per
+ * size, chained like cached blocks */
+#define QUICK_MAX_SIZE 1024
+#define QUICK_BINS ((QUICK_MAX_SIZE - MIN_BLOCK) / DSIZE + 1)
+#define QUICK_IDX(size) (((size) - MIN_BLOCK) / DSIZE)
+
+/* Set to 0 to free blocks of other arenas under their lock instead */
+#ifndef REMOTE_FREE
+#define REMOTE_FREE 1
+#endif
+
+/* Set to 0 to stop counting allocations and frees per size class */
+#ifndef COUNT_STATS
+#define COUNT_STATS 1
+#endif
+
+/* Defaults for when free memory is given back to the OS */
+#define DEFAULT_TRIM_THRESHOLD   (128 * 1024)
+#define DEFAULT_RELEASE_THRESHOLD (1024 * 1024)
+#define DEFAULT_MMAP_THRESHOLD   (128 * 1024)
+
+/* Quick lists are consolidated once they hold this many bytes */
+#define DEFAULT_QUICK_THRESHOLD  (64 * 1024)
+
+/* A mmapped block starts MMAP_OFF bytes into its region, at least MMAP_HDR,
+ * and is preceded by the region length and that offset */
+#define MMAP_HDR (2*DSIZE)
+#define MMAP_LEN(bp) (*(size_t *)((char *)(bp) - MMAP_HDR))
+#define MMAP_OFF(bp) (*(size_t *)((char *)(bp) - DSIZE))
+
+/* Usable payload bytes of heap block bp and of mmapped block bp */
+#define BLOCK_USABLE(bp) (GET_SIZE(HDRP(bp)) - OVERHEAD)
+#define MMAP_USABLE(bp)  (MMAP_LEN(bp) - MMAP_OFF(bp))
+
+/* Block bp was just allocated: the memory below its end is no longer fresh */
+#define MARK_USED(a, bp) \
+    do { if (NEXT_BLKP(bp) > (a)->fresh) (a)->fresh = NEXT_BLKP(bp); } while (0)
+
+/* Blocks outside every memlib heap are mmapped */
+#define IS_MMAPPED(bp) (mem_heap_id(bp) < 0)
+
+/* The last memlib heap holds the slabs, the others the arenas */
+#define SLAB_HEAP (MEM_MAX_HEAPS - 1)
+#define IS_SLAB(bp) slab_owns(bp)
+
+/* Arena i grows memlib heap i */
+#define MM_MAX_ARENAS (MEM_MAX_HEAPS - 1)
 /* $end mallocmacros */
 
+/* An independent heap with its own free lists, guarded by its own lock */
+struct arena {
+    pthread_mutex_t lock;
+    int heap;                            /* memlib heap this arena grows */
+    char *heap_listp;                    /* Pointer to first block */
+    char *explicit_free_listp;           /* Pointer to first free block */
+    char *rover;                         /* Next fit starts at the first free block from here */
+    char *seg_lists[NUM_CLASSES];        /* Segregated free lists, one per size class */
+    unsigned int seg_nonempty;           /* Bit c is set iff seg_lists[c] is non-empty */
+    char *tree_root;                     /* Splay tree of free blocks, best and next fit */
+    char *remote_frees;                  /* Blocks freed by other threads, pushed lock-free */
+    size_t trimmed_bytes;                /* Given back by shrinking the heap */
+    size_t released_bytes;               /* Given back with madvise */
+    char *fresh;                         /* Heap memory from here up was never allocated */
+    size_t search_steps;                 /* Blocks examined by the current find_fit */
+    size_t fit_searches[MM_SEARCH_BUCKETS]; /* find_fit calls by search_bucket(steps) */
+    char *quick[QUICK_BINS];             /* Freed blocks not coalesced yet, by size */
+    size_t quick_bytes;                  /* Bytes on the quick lists */
+    size_t consolidations;               /* Consolidation passes */
+};
+
 /* Global variables */
-static char *heap_listp = 0;  /* Pointer to first block */  
-static char *explicit_free_listp = 0; /* Pointer to first free block */
-static char *rover;           /* Next fit rover */
+static struct arena arenas[MM_MAX_ARENAS] = {
+    [0 ... MM_MAX_ARENAS-1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+static int narenas;                      /* Arenas threads are assigned to */
+static unsigned int next_arena;          /* Round-robin assignment counter */
+static __thread struct arena *thread_arena;
+static size_t trim_threshold = DEFAULT_TRIM_THRESHOLD;
+static size_t release_threshold = DEFAULT_RELEASE_THRESHOLD;
+static int hugepages;           /* MM_HUGEPAGES */
+static size_t mmap_threshold = DEFAULT_MMAP_THRESHOLD;
+static size_t mmap_threshold_opt = DEFAULT_MMAP_THRESHOLD; /* As mm_mallopt set it */
+static size_t mmapped_bytes;             /* Updated atomically */
+static size_t mmapped_regions;
+static size_t slab_max_size = SLAB_MAX_SIZE;
+static size_t slab_max_opt = SLAB_MAX_SIZE;      /* As mm_mallopt set it */
+static size_t quick_max;                 /* Largest block put on a quick list, 0 for none */
+static size_t quick_threshold = DEFAULT_QUICK_THRESHOLD;
+static size_t realloc_inplace;           /* Updated atomically */
+static size_t realloc_moved;
+static size_t realloc_copied;
+static size_t calloc_fresh;              /* Updated atomically */
+static size_t calloc_cleared;
+
+/* What mm_persist saves of an arena, the block pointers its heap needs */
+struct arena_state {
+    char *heap_listp;
+    char *explicit_free_listp;
+    char *rover;
+    char *seg_lists[NUM_CLASSES];
+    unsigned int seg_nonempty;
+    char *tree_root;
+    char *fresh;
+    char *quick[QUICK_BINS];
+    size_t quick_bytes;
+};
+
+/* Allocator state in the root area of a heap file's header */
+#define PERSIST_MAGIC 0x6d6d73746174653aUL
+#define PERSIST_LAYOUT ((sizeof(struct persist) << 16) | (WSIZE << 8) | ALLOC_FOOTERS)
+struct persist {
+    unsigned long magic;                 /* PERSIST_MAGIC while the state is current */
+    unsigned long layout;                /* PERSIST_LAYOUT of the build that saved it */
+    void *root;                          /* The application's root object */
+    int mode;                            /* fit_mode of the heaps */
+    size_t live_bytes;
+    struct arena_state arenas[MM_MAX_ARENAS];
+};
+_Static_assert(sizeof(struct persist) <= MEM_ROOT_SIZE, "persist does not fit the heap file header");
+static struct persist *persist;          /* In the heap file, NULL without one */
+
+/* Per-thread cache of freed blocks */
+struct tcache {
+    char *bins[TCACHE_BINS];
+    unsigned char counts[TCACHE_BINS];
+    int registered;                  /* Flushed back to the heap at thread exit */
+};
+static __thread struct tcache tcache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+
+/* Per-thread allocation counters, summed up by mm_stats. Only the owning
+ * thread writes them, so counting costs no atomic instruction. */
+struct thread_stats {
+    size_t allocs[MM_SIZE_CLASSES];
+    size_t frees[MM_SIZE_CLASSES];
+    size_t live_bytes;               /* Wraps around if the thread frees more than it allocates */
+    int registered;                  /* Linked into stats_threads */
+    struct thread_stats *next, *prev;
+};
+static __thread struct thread_stats thread_stats;
+static struct thread_stats *stats_threads;   /* Guarded by stats_lock */
+static struct thread_stats exited_stats;     /* Counters of exited threads */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t stats_key;
+static pthread_once_t stats_key_once = PTHREAD_ONCE_INIT;
+
+/* Owner-only update of a counter that other threads read */
+#define STAT_ADD(x, n) __atomic_store_n(&(x), (x) + (n), __ATOMIC_RELAXED)
 
 /* Function prototypes for internal helper routines */
-static void *extend_heap(size_t words);
-static void place(void *bp, size_t asize);
-static void *find_fit(size_t asize);
-static void *coalesce(void *bp);
-static void printblock(void *bp); 
-static void checkheap(int verbose);
+static int arena_init(struct arena *a);
+static struct arena *arena_of(void *bp);
+static struct arena *pick_arena(void);
+static struct arena *lock_arena(void);
+static size_t adjust_size(size_t size);
+static void *malloc_block(struct arena *a, size_t asize);
+static void *malloc_retry(size_t asize);
+static void free_block(struct arena *a, void *bp);
+static void remote_free(struct arena *a, void *bp);
+static void drain_remote_frees(struct arena *a);
+static int quick_put(struct arena *a, void *bp);
+static void *quick_get(struct arena *a, size_t asize);
+static void consolidate(struct arena *a);
+static void *realloc_block(struct arena *a, void *bp, size_t asize);
+static void split_block(struct arena *a, void *bp, size_t asize);
+static void *memalign_block(struct arena *a, size_t asize, size_t align);
+static char *align_fit(void *bp, size_t asize, size_t align);
+static void *mmap_block(size_t size, size_t align);
+static void *remap_block(void *bp, size_t size);
+static void unmap_block(void *bp);
+static size_t trim_top(struct arena *a, size_t pad);
+static size_t release_block(struct arena *a, void *bp);
+static void *tcache_get(size_t asize);
+static int tcache_put(void *bp);
+static void tcache_flush(void *arg);
+static void tcache_make_key(void);
+static void *count_alloc(void *bp, size_t size);
+static void count_free(void *bp, size_t size);
+static void stats_register(void);
+static void stats_exit(void *arg);
+static void stats_make_key(void);
+static void stats_add(struct thread_stats *sum, struct thread_stats *ts);
+static int search_bucket(size_t steps);
+static void *extend_heap(struct arena *a, size_t words);
+static void place(struct arena *a, void *bp, size_t asize);
+static void *find_fit(struct arena *a, size_t asize);
+static void *coalesce(struct arena *a, void *bp);
+static void printblock(struct arena *a, void *bp);
+static void checkheap(struct arena *a, int verbose);
 static void checkblock(void *bp);
-static void push_to_explicit_free_list(void *bp);
-static void insert_to_explicit_free_list(void *bp, void *pred_bp, void *succ_bp);
-static void remove_from_explicit_free_list(void * bp);
+static void push_to_explicit_free_list(struct arena *a, void *bp);
+static void insert_to_explicit_free_list(struct arena *a, void *bp, void *pred_bp, void *succ_bp);
+static void remove_from_explicit_free_list(struct arena *a, void * bp);
+static int size_class(size_t size);
+static char **free_list_head(struct arena *a, size_t size);
+static char *splay(char *t, size_t size, char *addr, size_t *steps);
+static void tree_insert(struct arena *a, void *bp);
+static void tree_remove(struct arena *a, void *bp);
+static void *tree_best_fit(struct arena *a, size_t asize);
+static char *tree_ceiling(struct arena *a, char *addr);
+static void printtree(char *t);
+static void debug_arena(struct arena *a);
+static int restore_state(void);
+
+/* 
+ * mm_init - Initialize the memory manager 
+ */
+int mm_init(int allocAlg) 
+{
+    struct thread_stats *ts;
+    int i;
+
+#ifndef FIT_MODE
+    fit_mode = allocAlg;
+#endif
+    if (narenas == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        narenas = (ncpu < 1) ? 1 : (ncpu > MM_MAX_ARENAS) ? MM_MAX_ARENAS : ncpu;
+    }
+    for (i = 0; i < MM_MAX_ARENAS; i++) {
+        struct arena *a = &arenas[i];
+        a->heap = i;
+        a->heap_listp = 0;
+        a->explicit_free_listp = 0;
+        a->rover = 0;
+        memset(a->seg_lists, 0, sizeof(a->seg_lists));
+        a->seg_nonempty = 0;
+        a->tree_root = 0;
+        a->remote_frees = 0;
+        a->trimmed_bytes = 0;
+        a->released_bytes = 0;
+        a->fresh = 0;
+        memset(a->fit_searches, 0, sizeof(a->fit_searches));
+        memset(a->quick, 0, sizeof(a->quick));
+        a->quick_bytes = 0;
+        a->consolidations = 0;
+    }
+    next_arena = 0;
+    thread_arena = NULL;
+    mmapped_bytes = 0;
+    mmapped_regions = 0;
+    realloc_inplace = realloc_moved = realloc_copied = 0;
+    calloc_fresh = calloc_cleared = 0;
+    pthread_mutex_lock(&stats_lock);
+    for (ts = stats_threads; ts != NULL; ts = ts->next) {
+        memset(ts->allocs, 0, sizeof(ts->allocs));
+        memset(ts->frees, 0, sizeof(ts->frees));
+        ts->live_bytes = 0;
+    }
+    memset(&exited_stats, 0, sizeof(exited_stats));
+    pthread_mutex_unlock(&stats_lock);
+    slab_init(SLAB_HEAP);
+    heapprof_reset();
+    /* Blocks cached by this thread belonged to the old heap */
+    memset(tcache.bins, 0, sizeof(tcache.bins));
+    memset(tcache.counts, 0, sizeof(tcache.counts));
+
+    /* In a heap file every block must be in the file: slabs and mmapped
+     * blocks would not survive the process. Without one, take the limits
+     * mm_mallopt set back up in case an earlier heap had a file. */
+    slab_max_size = slab_max_opt;
+    mmap_threshold = mmap_threshold_opt;
+    if ((persist = mem_file_root()) != NULL) {
+        slab_max_size = 0;
+        mmap_threshold = SIZE_MAX;
+        if (persist->magic == PERSIST_MAGIC)
+            return restore_state();
+    }
+
+    /* The other arenas are created when a thread first uses them */
+    return arena_init(&arenas[0]);
+}
+
+/*
+ * restore_state - Take up the arenas mm_persist saved in the heap file.
+ *                 The fit mode is the one they were built with; a build
+ *                 for a single fit mode can only take up its own.
+ */
+static int restore_state(void)
+{
+    int i;
+
+    if (persist->layout != PERSIST_LAYOUT) {
+        fprintf(stderr, "ERROR: mm_init: the heap file was written by an incompatible build\n");
+        persist = NULL;
+        return -1;
+    }
+#ifdef FIT_MODE
+    if (persist->mode != FIT_MODE) {
+        fprintf(stderr, "ERROR: mm_init: the heap file was built with fit mode %d\n",
+                persist->mode);
+        persist = NULL;
+        return -1;
+    }
+#else
+    fit_mode = persist->mode;
+#endif
+    for (i = 0; i < MM_MAX_ARENAS; i++) {
+        struct arena *a = &arenas[i];
+        struct arena_state *as = &persist->arenas[i];
+        a->heap_listp = as->heap_listp;
+        a->explicit_free_listp = as->explicit_free_listp;
+        a->rover = as->rover;
+        memcpy(a->seg_lists, as->seg_lists, sizeof(a->seg_lists));
+        a->seg_nonempty = as->seg_nonempty;
+        a->tree_root = as->tree_root;
+        a->fresh = as->fresh;
+        memcpy(a->quick, as->quick, sizeof(a->quick));
+        a->quick_bytes = as->quick_bytes;
+    }
+    exited_stats.live_bytes = persist->live_bytes;
+
+    /* From now on the saved state goes stale, until the next mm_persist */
+    persist->magic = 0;
+    return 0;
+}
+
+/*
+ * mm_persist - Save the allocator state in the heap file, if memlib has
+ *              one, for mm_init to reattach to after the next mem_init.
+ *              Must be the last call into the allocator before mem_deinit,
+ *              made once every other thread using it has exited.
+ */
+void mm_persist(void)
+{
+    struct thread_stats sum, *ts;
+    int i;
+
+    if (persist == NULL)
+        return;
+    tcache_flush(&tcache);
+    for (i = 0; i < MM_MAX_ARENAS; i++) {
+        struct arena *a = &arenas[i];
+        struct arena_state *as = &persist->arenas[i];
+        pthread_mutex_lock(&a->lock);
+        if (a->heap_listp != 0)
+            drain_remote_frees(a);
+        as->heap_listp = a->heap_listp;
+        as->explicit_free_listp = a->explicit_free_listp;
+        as->rover = a->rover;
+        memcpy(as->seg_lists, a->seg_lists, sizeof(as->seg_lists));
+        as->seg_nonempty = a->seg_nonempty;
+        as->tree_root = a->tree_root;
+        as->fresh = a->fresh;
+        memcpy(as->quick, a->quick, sizeof(as->quick));
+        as->quick_bytes = a->quick_bytes;
+        pthread_mutex_unlock(&a->lock);
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    sum = exited_stats;
+    for (ts = stats_threads; ts != NULL; ts = ts->next)
+        stats_add(&sum, ts);
+    pthread_mutex_unlock(&stats_lock);
+    persist->live_bytes = sum.live_bytes;
+    persist->mode = fit_mode;
+    persist->layout = PERSIST_LAYOUT;
+    persist->magic = PERSIST_MAGIC;
+    persist = NULL;
+}
+
+/*
+ * mm_heap_fit_mode - The fit mode of the heaps in the heap file, or -1 if
+ *                    there are none to reattach to. Call after mem_init.
+ */
+int mm_heap_fit_mode(void)
+{
+    struct persist *p = mem_file_root();
+
+    return (p != NULL && p->magic == PERSIST_MAGIC) ? p->mode : -1;
+}
+
+/*
+ * mm_set_root - Remember p as the application's root object in the heap
+ *               file, where mm_get_root finds it after reattaching
+ */
+void mm_set_root(void *p)
+{
+    if (persist != NULL)
+        persist->root = p;
+}
+
+/*
+ * mm_get_root - The root object of the heap file, NULL for none
+ */
+void *mm_get_root(void)
+{
+    return persist ? persist->root : NULL;
+}
+
+/*
+ * mm_mallopt - Set a tunable parameter. Returns 1 on success, 0 on error.
+ */
+int mm_mallopt(int param, size_t value)
+{
+    switch (param) {
+    case MM_ARENA_MAX:
+        if (value < 1 || value > MM_MAX_ARENAS)
+            return 0;
+        narenas = value;
+        return 1;
+    case MM_HEAP_MAX:
+        /* Free blocks of a larger heap could coalesce past what 4-byte headers hold */
+        if (!WIDE_HEADERS && value > ((size_t)4 << 30))
+            return 0;
+        return mem_set_max_heap(value);
+    case MM_TRIM_THRESHOLD:
+        trim_threshold = value;
+        return 1;
+    case MM_RELEASE_THRESHOLD:
+        release_threshold = value;
+        return 1;
+    case MM_MMAP_THRESHOLD:
+        if (persist != NULL)
+            return 0;
+        mmap_threshold = mmap_threshold_opt = value;
+        return 1;
+    case MM_SLAB_MAX:
+        if (value > SLAB_MAX_SIZE || persist != NULL)
+            return 0;
+        slab_max_size = slab_max_opt = value;
+        return 1;
+    case MM_QUICK_MAX:
+        if (value > QUICK_MAX_SIZE - OVERHEAD)
+            return 0;
+        quick_max = value ? adjust_size(value) : 0;
+        return 1;
+    case MM_QUICK_THRESHOLD:
+        quick_threshold = value;
+        return 1;
+    case MM_PROFILE_PERIOD:
+        return heapprof_set_period(value);
+    case MM_HUGEPAGES:
+        if (!mem_set_hugepages(value != 0))
+            return 0;
+        hugepages = (value != 0);
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * mm_malloc - Allocate a block with at least size bytes of payload
+ */
+HEAPPROF_ENTRY void *mm_malloc(size_t size)
+{
+    struct arena *a;
+    size_t asize;
+    char *bp;
+
+    /* Ignore spurious requests */
+    if (size == 0 || size > MAX_REQUEST)
+        return NULL;
+    if (size >= mmap_threshold) {
+        bp = mmap_block(size, DSIZE);
+        return bp ? count_alloc(bp, MMAP_USABLE(bp)) : NULL;
+    }
+    if (size <= slab_max_size && (bp = slab_alloc(size)) != NULL)
+        return count_alloc(bp, slab_size(bp));
+    asize = adjust_size(size);
+
+    /* Reuse a block this thread freed without taking a lock */
+    if ((bp = tcache_get(asize)) != NULL)
+        return count_alloc(bp, asize - OVERHEAD);
+
+    a = lock_arena();
+    drain_remote_frees(a);
+    bp = malloc_block(a, asize);
+    pthread_mutex_unlock(&a->lock);
+    if (bp == NULL && (bp = malloc_retry(asize)) == NULL)
+        return NULL;
+    return count_alloc(bp, BLOCK_USABLE(bp));
+}
+
+/*
+ * mm_calloc - Allocate zeroed space for nmemb objects of size bytes. Memory
+ *             fresh from the OS is already zero and is not cleared again.
+ */
+HEAPPROF_ENTRY void *mm_calloc(size_t nmemb, size_t size)
+{
+    struct arena *a;
+    size_t bytes, asize, psize;
+    char *bp, *fresh;
+
+    if (nmemb != 0 && size > SIZE_MAX / nmemb)
+        return NULL;
+    bytes = nmemb * size;
+    if (bytes == 0 || bytes > MAX_REQUEST)
+        return NULL;
+    if (bytes >= mmap_threshold) {
+        __atomic_add_fetch(&calloc_fresh, 1, __ATOMIC_RELAXED);
+        bp = mmap_block(bytes, DSIZE);
+        return bp ? count_alloc(bp, MMAP_USABLE(bp)) : NULL;
+    }
+    if (bytes <= slab_max_size && (bp = slab_calloc(bytes)) != NULL)
+        return count_alloc(bp, slab_size(bp));
+    asize = adjust_size(bytes);
+
+    if ((bp = tcache_get(asize)) == NULL) {
+        a = lock_arena();
+        drain_remote_frees(a);
+        fresh = a->fresh;
+        bp = malloc_block(a, asize);
+        pthread_mutex_unlock(&a->lock);
+        if (bp != NULL && bp >= fresh) {
+            /* Only the free block's links and footer were ever written */
+            psize = GET_SIZE(HDRP(bp)) - OVERHEAD;
+            memset(bp, 0, 2*sizeof(char *));
+            memset(bp + psize - DSIZE, 0, DSIZE);
+            __atomic_add_fetch(&calloc_fresh, 1, __ATOMIC_RELAXED);
+            return count_alloc(bp, BLOCK_USABLE(bp));
+        }
+        if (bp == NULL && (bp = malloc_retry(asize)) == NULL)
+            return NULL;
+    }
+    memset(bp, 0, bytes);
+    __atomic_add_fetch(&calloc_cleared, 1, __ATOMIC_RELAXED);
+    return count_alloc(bp, BLOCK_USABLE(bp));
+}
+
+/*
+ * mm_memalign - Allocate a block with at least size bytes of payload at an
+ *               address that is a multiple of alignment, a power of two.
+ *               The block is carved out of a free block and the slack
+ *               on either side goes back to the free lists.
+ */
+HEAPPROF_ENTRY void *mm_memalign(size_t alignment, size_t size)
+{
+    struct arena *a;
+    size_t asize;
+    char *bp;
+
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+        return NULL;
+    if (alignment <= DSIZE)
+        return mm_malloc(size);
+    if (size == 0 || size > SIZE_MAX - alignment - mem_pagesize() - 4*DSIZE)
+        return NULL;
+    if (size >= mmap_threshold) {
+        bp = mmap_block(size, alignment);
+        return bp ? count_alloc(bp, MMAP_USABLE(bp)) : NULL;
+    }
+    asize = adjust_size(size);
+
+    a = lock_arena();
+    drain_remote_frees(a);
+    bp = memalign_block(a, asize, alignment);
+    pthread_mutex_unlock(&a->lock);
+    if (bp == NULL) {
+        /* As in malloc_retry */
+        int i, start = thread_arena - arenas;
+
+        tcache_flush(&tcache);
+        for (i = 0; i < narenas && bp == NULL; i++) {
+            a = &arenas[(start + i) % narenas];
+            pthread_mutex_lock(&a->lock);
+            drain_remote_frees(a);
+            bp = memalign_block(a, asize, alignment);
+            pthread_mutex_unlock(&a->lock);
+        }
+    }
+    return bp ? count_alloc(bp, BLOCK_USABLE(bp)) : NULL;
+}
+
+/*
+ * mm_free - Free a block
+ */
+void mm_free(void *bp)
+{
+    struct arena *a;
+
+    if (bp == 0)
+        return;
+    if (IS_MMAPPED(bp)) {
+        count_free(bp, MMAP_USABLE(bp));
+        unmap_block(bp);
+        return;
+    }
+    if (IS_SLAB(bp)) {
+        count_free(bp, slab_size(bp));
+        slab_free(bp);
+        return;
+    }
+    count_free(bp, BLOCK_USABLE(bp));
+    if (tcache_put(bp))
+        return;
+
+    a = arena_of(bp);
+    if (REMOTE_FREE && a != thread_arena) {
+        remote_free(a, bp);
+        return;
+    }
+    pthread_mutex_lock(&a->lock);
+    if (!quick_put(a, bp))
+        free_block(a, bp);
+    pthread_mutex_unlock(&a->lock);
+}
+
+/*
+ * mm_usable_size - Bytes of payload in block bp, at least what was asked for
+ */
+size_t mm_usable_size(void *bp)
+{
+    if (bp == NULL)
+        return 0;
+    if (IS_MMAPPED(bp))
+        return MMAP_USABLE(bp);
+    if (IS_SLAB(bp))
+        return slab_size(bp);
+    return BLOCK_USABLE(bp);
+}
+
+/*
+ * mm_fork_prepare - Take every allocator lock before fork, so that the
+ *                   child does not inherit a lock held by a thread it
+ *                   does not have. mm_fork_done releases them again, in
+ *                   the parent and in the child.
+ */
+void mm_fork_prepare(void)
+{
+    int i;
+
+    for (i = 0; i < MM_MAX_ARENAS; i++)
+        pthread_mutex_lock(&arenas[i].lock);
+    slab_lock_all();
+    pthread_mutex_lock(&stats_lock);
+    heapprof_lock();
+}
+
+void mm_fork_done(void)
+{
+    int i;
+
+    heapprof_unlock();
+    pthread_mutex_unlock(&stats_lock);
+    slab_unlock_all();
+    for (i = MM_MAX_ARENAS - 1; i >= 0; i--)
+        pthread_mutex_unlock(&arenas[i].lock);
+}
+
+/*
+ * mm_trim - Give free memory back to the OS: shrink every heap down to pad
+ *           bytes of free space at the top, release the pages of free
+ *           blocks of at least the release threshold, and those of empty
+ *           slabs. Returns bytes freed.
+ */
+size_t mm_trim(size_t pad)
+{
+    size_t total = 0;
+    char *bp;
+    int i;
+
+    /* Blocks sitting in our cache would pin the top of the heap */
+    tcache_flush(&tcache);
+    for (i = 0; i < MM_MAX_ARENAS; i++) {
+        struct arena *a = &arenas[i];
+        pthread_mutex_lock(&a->lock);
+        if (a->heap_listp != 0) {
+            drain_remote_frees(a);
+            consolidate(a);
+            total += trim_top(a, pad);
+            for (bp = a->heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+                if (!GET_ALLOC(HDRP(bp)) && GET_SIZE(HDRP(bp)) >= release_threshold)
+                    total += release_block(a, bp);
+            }
+        }
+        pthread_mutex_unlock(&a->lock);
+    }
+    return total + slab_trim();
+}
+
+/*
+ * mm_stats - Report heap usage and how much memory went back to the OS
+ */
+void mm_stats(struct mm_stats *st)
+{
+    struct thread_stats sum, *ts;
+    size_t trimmed, released;
+    char *bp;
+    int i, c;
+
+    memset(st, 0, sizeof(*st));
+    for (i = 0; i < MM_MAX_ARENAS; i++) {
+        struct arena *a = &arenas[i];
+        pthread_mutex_lock(&a->lock);
+        if (a->heap_listp != 0) {
+            for (bp = a->heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+                if (!GET_ALLOC(HDRP(bp))) {
+                    st->free_bytes += GET_SIZE(HDRP(bp));
+                    st->free_blocks++;
+                    st->free_list_blocks[size_class(GET_SIZE(HDRP(bp)))]++;
+                    if (GET_SIZE(HDRP(bp)) > st->largest_free_block)
+                        st->largest_free_block = GET_SIZE(HDRP(bp));
+                }
+            }
+        }
+        for (c = 0; c < MM_SEARCH_BUCKETS; c++)
+            st->fit_searches[c] += a->fit_searches[c];
+        st->trimmed_bytes += a->trimmed_bytes;
+        st->released_bytes += a->released_bytes;
+        st->quick_bytes += a->quick_bytes;
+        st->consolidations += a->consolidations;
+        pthread_mutex_unlock(&a->lock);
+    }
+    if (st->free_bytes > 0)
+        st->fragmentation = 1.0 - (double)st->largest_free_block / st->free_bytes;
+
+    pthread_mutex_lock(&stats_lock);
+    sum = exited_stats;
+    for (ts = stats_threads; ts != NULL; ts = ts->next)
+        stats_add(&sum, ts);
+    pthread_mutex_unlock(&stats_lock);
+    memcpy(st->allocs, sum.allocs, sizeof(st->allocs));
+    memcpy(st->frees, sum.frees, sizeof(st->frees));
+    st->live_bytes = sum.live_bytes;
+    st->heap_size = mem_heapsize();
+    slab_stats(&st->slab_bytes, &st->slab_used_bytes);
+    slab_trim_stats(&trimmed, &released);
+    st->trimmed_bytes += trimmed;
+    st->released_bytes += released;
+    heapprof_totals(&st->profile_samples, &st->profile_bytes);
+    st->mmapped_bytes = __atomic_load_n(&mmapped_bytes, __ATOMIC_RELAXED);
+    st->mmapped_regions = __atomic_load_n(&mmapped_regions, __ATOMIC_RELAXED);
+    st->trim_threshold = trim_threshold;
+    st->release_threshold = release_threshold;
+    st->mmap_threshold = mmap_threshold;
+    st->hugepages = hugepages;
+    st->huge_bytes = mem_huge_bytes();
+    st->realloc_inplace = __atomic_load_n(&realloc_inplace, __ATOMIC_RELAXED);
+    st->realloc_moved = __atomic_load_n(&realloc_moved, __ATOMIC_RELAXED);
+    st->realloc_copied = __atomic_load_n(&realloc_copied, __ATOMIC_RELAXED);
+    st->calloc_fresh = __atomic_load_n(&calloc_fresh, __ATOMIC_RELAXED);
+    st->calloc_cleared = __atomic_load_n(&calloc_cleared, __ATOMIC_RELAXED);
+}
+
+/*
+ * mm_stats_dump - Write the statistics of mm_stats to file descriptor fd
+ *                 as a JSON object
+ */
+void mm_stats_dump(int fd)
+{
+    struct mm_stats st;
+    int c;
+
+    mm_stats(&st);
+    dprintf(fd, "{\n  \"fit_mode\": %d,\n  \"heap_size\": %zu,\n  \"live_bytes\": %zu,\n"
+            "  \"free_bytes\": %zu,\n  \"free_blocks\": %zu,\n  \"largest_free_block\": %zu,\n"
+            "  \"fragmentation\": %.4f,\n",
+            fit_mode, st.heap_size, st.live_bytes, st.free_bytes, st.free_blocks,
+            st.largest_free_block, st.fragmentation);
+    dprintf(fd, "  \"trimmed_bytes\": %zu,\n  \"released_bytes\": %zu,\n"
+            "  \"mmapped_bytes\": %zu,\n  \"mmapped_regions\": %zu,\n"
+            "  \"slab_bytes\": %zu,\n  \"slab_used_bytes\": %zu,\n",
+            st.trimmed_bytes, st.released_bytes, st.mmapped_bytes, st.mmapped_regions,
+            st.slab_bytes, st.slab_used_bytes);
+    dprintf(fd, "  \"realloc\": { \"inplace\": %zu, \"moved\": %zu, \"copied\": %zu },\n"
+            "  \"calloc\": { \"fresh\": %zu, \"cleared\": %zu },\n",
+            st.realloc_inplace, st.realloc_moved, st.realloc_copied,
+            st.calloc_fresh, st.calloc_cleared);
+    dprintf(fd, "  \"quick\": { \"bytes\": %zu, \"consolidations\": %zu },\n",
+            st.quick_bytes, st.consolidations);
+    dprintf(fd, "  \"profile\": { \"period\": %zu, \"live_samples\": %zu, \"live_bytes\": %zu },\n",
+            heapprof_period, st.profile_samples, st.profile_bytes);
+    dprintf(fd, "  \"thp\": { \"enabled\": %s, \"huge_bytes\": %zu, \"coverage\": %.4f },\n",
+            st.hugepages ? "true" : "false", st.huge_bytes,
+            st.heap_size ? (double)st.huge_bytes / st.heap_size : 0.0);
+
+    /* Class c holds sizes up to 32 << c, the last one everything larger */
+    dprintf(fd, "  \"size_classes\": [\n");
+    for (c = 0; c < MM_SIZE_CLASSES; c++) {
+        if (c < MM_SIZE_CLASSES - 1)
+            dprintf(fd, "    { \"max_size\": %lu, ", 32UL << c);
+        else
+            dprintf(fd, "    { \"max_size\": null, ");
+        dprintf(fd, "\"allocs\": %zu, \"frees\": %zu, \"free_blocks\": %zu }%s\n",
+                st.allocs[c], st.frees[c], st.free_list_blocks[c],
+                c < MM_SIZE_CLASSES - 1 ? "," : "");
+    }
+    dprintf(fd, "  ],\n");
+
+    /* Bucket 0 counts searches that examined no block, bucket b those
+     * that examined 2^(b-1) to 2^b - 1, the last one everything more */
+    dprintf(fd, "  \"find_fit_steps\": [\n");
+    for (c = 0; c < MM_SEARCH_BUCKETS; c++) {
+        if (c < MM_SEARCH_BUCKETS - 1)
+            dprintf(fd, "    { \"max_steps\": %lu, ", (1UL << c) - 1);
+        else
+            dprintf(fd, "    { \"max_steps\": null, ");
+        dprintf(fd, "\"searches\": %zu }%s\n", st.fit_searches[c],
+                c < MM_SEARCH_BUCKETS - 1 ? "," : "");
+    }
+    dprintf(fd, "  ]\n}\n");
+}
+
+/*
+ * mm_profile_dump - Write the call stacks of the live sampled blocks to
+ *                   file descriptor fd, as a pprof heap profile or as
+ *                   folded stacks (MM_PROFILE_PPROF or MM_PROFILE_FOLDED)
+ */
+void mm_profile_dump(int fd, int format)
+{
+    heapprof_dump(fd, format == MM_PROFILE_FOLDED);
+}
+
+/*
+ * The remaining routines are internal helper routines
+ */
+
+/*
+ * arena_init - Create the initial empty heap of arena a
+ */
+/* $begin mminit */
+static int arena_init(struct arena *a)
+{
+    char *heap_listp;
+
+    /* Create the initial empty heap */
+    if ((heap_listp = mem_heap_sbrk(a->heap, 4*WSIZE)) == (void *)-1) //line:vm:mm:begininit
+        return -1;
+    PUT(heap_listp, 0);                          /* Alignment padding */
+    PUT(heap_listp + (1*WSIZE), PACK(DSIZE, 1) | PREV_ALLOC); /* Prologue header */ 
+    PUT(heap_listp + (2*WSIZE), PACK(DSIZE, 1)); /* Prologue footer */ 
+    PUT(heap_listp + (3*WSIZE), PACK(0, 1) | PREV_ALLOC); /* Epilogue header */
+    heap_listp += (2*WSIZE);                     //line:vm:mm:endinit  
+    /* $end mminit */
+
+    /* $begin mminit */
+    a->heap_listp = heap_listp;
+    a->fresh = heap_listp + DSIZE;               /* The first block */
+
+    /* Extend the empty heap with a free block of CHUNKSIZE bytes */
+    if (extend_heap(a, CHUNKSIZE/WSIZE) == NULL)
+        return -1;
+    a->rover = heap_listp;
+    return 0;
+}
+/* $end mminit */
+
+/* 
+ * arena_of - Return the arena whose heap contains block bp
+ */
+static struct arena *arena_of(void *bp)
+{
+    return &arenas[mem_heap_id(bp)];
+}
+
+/* 
+ * pick_arena - Assign the calling thread to the next arena round-robin
+ */
+static struct arena *pick_arena(void)
+{
+    unsigned int i = __atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED);
+
+    thread_arena = &arenas[i % narenas];
+    return thread_arena;
+}
+
+/*
+ * lock_arena - Lock and return the calling thread's arena. A thread that
+ *              finds its arena busy moves on to the next one.
+ */
+static struct arena *lock_arena(void)
+{
+    struct arena *a = thread_arena;
+
+    if (a == NULL)
+        a = pick_arena();
+    if (pthread_mutex_trylock(&a->lock) != 0) {
+        a = pick_arena();
+        pthread_mutex_lock(&a->lock);
+    }
+    return a;
+}
+
+/*
+ * adjust_size - Block size needed for size bytes of payload
+ */
+static size_t adjust_size(size_t size)
+{
+    /* Adjust block size to include overhead and alignment reqs. */
+    if (size <= MIN_BLOCK - OVERHEAD)                             //line:vm:mm:sizeadjust1
+        return MIN_BLOCK;                                       //line:vm:mm:sizeadjust2
+    return DSIZE * ((size + (OVERHEAD) + (DSIZE-1)) / DSIZE);   //line:vm:mm:sizeadjust3
+}
+
+/* 
+ * malloc_block - Allocate a block of asize bytes from arena a.
+ *                Called with the arena locked.
+ */
+/* $begin mmmalloc */
+static void *malloc_block(struct arena *a, size_t asize)
+{
+    size_t extendsize; /* Amount to extend heap if no fit */
+    char *bp;      
+
+    /* $end mmmalloc */
+    if (a->heap_listp == 0 && arena_init(a) < 0) {
+        return NULL;
+    }
+    if (a->quick_bytes != 0 && (bp = quick_get(a, asize)) != NULL)
+        return bp;
+    a->search_steps = 0;
+    bp = find_fit(a, asize);
+    if (bp == NULL && a->quick_bytes != 0) {
+        /* Coalesce the quick lists and look again before growing the heap */
+        consolidate(a);
+        bp = find_fit(a, asize);
+    }
+    a->fit_searches[search_bucket(a->search_steps)]++;
+    /* $begin mmmalloc */
+    /* Search the free list for a fit */
+    if (bp != NULL) {                         //line:vm:mm:findfitcall
+        place(a, bp, asize);                  //line:vm:mm:findfitplace
+        return bp;
+    }
+
+    /* No fit found. Get more memory and place the block */
+    extendsize = MAX(asize,CHUNKSIZE);                 //line:vm:mm:growheap1
+    if ((bp = extend_heap(a, extendsize/WSIZE)) == NULL)
+        return NULL;                                  //line:vm:mm:growheap2
+    place(a, bp, asize);                              //line:vm:mm:growheap3
+    return bp;
+} 
+/* $end mmmalloc */
+
+/* 
+ * malloc_retry - The thread's arena is out of memory. Give back the blocks
+ *                this thread is holding on to, then try every arena.
+ */
+static void *malloc_retry(size_t asize)
+{
+    struct arena *a;
+    char *bp = NULL;
+    int i, start = thread_arena - arenas;
+
+    tcache_flush(&tcache);
+    for (i = 0; i < narenas && bp == NULL; i++) {
+        a = &arenas[(start + i) % narenas];
+        pthread_mutex_lock(&a->lock);
+        drain_remote_frees(a);
+        bp = malloc_block(a, asize);
+        pthread_mutex_unlock(&a->lock);
+    }
+    return bp;
+}
+
+/*
+ * free_block - Return a block to the free lists of arena a, which owns it.
+ *              Called with the arena locked.
+ */
+/* $begin mmfree */
+static void free_block(struct arena *a, void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+
+    PUT_HDR(HDRP(bp), PACK(size, 0));
+    PUT(FTRP(bp), PACK(size, 0));
+    CLEAR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+    bp = coalesce(a, bp);
+
+    /* Give memory back to the OS once enough of it is free, judging by the
+     * coalesced block rather than by the one just freed */
+    size = GET_SIZE(HDRP(bp));
+    if (GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0 && size >= trim_threshold)
+        trim_top(a, CHUNKSIZE);
+    else if (size >= release_threshold)
+        release_block(a, bp);
+}
+
+/*
+ * trim_top - If the last block of arena a is free, shrink the heap so that
+ *            block keeps about pad bytes. Returns the bytes given back.
+ */
+static size_t trim_top(struct arena *a, size_t pad)
+{
+    char *epilogue = mem_heap_sbrk(a->heap, 0); /* Block pointer of the epilogue */
+    size_t keep = MAX(DSIZE * ((pad + DSIZE-1) / DSIZE), MIN_BLOCK);
+    size_t size, shrink, unit = mem_commit_unit();
+    char *bp, *end;
+
+    /* The last block before the epilogue must be free */
+    if (GET_PREV_ALLOC(HDRP(epilogue)))
+        return 0;
+    bp = PREV_BLKP(epilogue);
+    size = GET_SIZE(HDRP(bp));
+    if (size <= keep)
+        return 0;
+    /* End the heap on a commit unit, where memlib drops the memory above
+     * it, so that the old footer and epilogue read as zero again */
+    end = (char *)(((uintptr_t)epilogue - (size - keep) + unit - 1) & ~(uintptr_t)(unit - 1));
+    if (end >= epilogue)
+        return 0;
+    shrink = epilogue - end;
+
+    if (mem_heap_sbrk(a->heap, -(intptr_t)shrink) == (void *)-1)
+        return 0;
+    remove_from_explicit_free_list(a, bp);
+    PUT_HDR(HDRP(bp), PACK(size - shrink, 0));
+    PUT(FTRP(bp), PACK(size - shrink, 0));
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));    /* New epilogue header */
+    push_to_explicit_free_list(a, bp);
+    a->trimmed_bytes += shrink;
+    return shrink;
+}
+
+/*
+ * release_block - Hand the pages inside free block bp back to the OS,
+ *                 keeping its header, free list links and footer
+ */
+static size_t release_block(struct arena *a, void *bp)
+{
+    size_t n = mem_release((char *)bp + 2*sizeof(char *), FTRP(bp));
+
+    a->released_bytes += n;
+    return n;
+}
+
+/*
+ * realloc_block - Resize allocated block bp of arena a to asize bytes
+ *                 without copying it to a new block: shrink it, grow it
+ *                 into a free next block or the end of the heap, or slide
+ *                 it down into a free previous block. Returns the new
+ *                 block pointer, or NULL if none of these is possible.
+ *                 Called with the arena locked.
+ */
+static void *realloc_block(struct arena *a, void *bp, size_t asize)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+    char *next = NEXT_BLKP(bp);
+    size_t nsize = GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next));
+    char *prev;
+    size_t size;
+
+    /* Shrink, giving back the tail */
+    if (asize <= csize) {
+        split_block(a, bp, asize);
+        __atomic_add_fetch(&realloc_inplace, 1, __ATOMIC_RELAXED);
+        return bp;
+    }
+
+    /* At the end of the heap, grow the heap under the block */
+    if (csize + nsize < asize &&
+        GET_SIZE(HDRP(nsize ? NEXT_BLKP(next) : next)) == 0 &&
+        extend_heap(a, MAX(asize - csize - nsize, CHUNKSIZE)/WSIZE) != NULL)
+        nsize = GET_SIZE(HDRP(next));  /* next is now the new free block */
+
+    /* Take in the free next block */
+    if (csize + nsize >= asize) {
+        remove_from_explicit_free_list(a, next);
+        size = csize + nsize;
+        PUT_HDR(HDRP(bp), PACK(size, 1));
+        PUT_ALLOC_FTR(bp, PACK(size, 1));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+        MARK_USED(a, bp);
+        split_block(a, bp, asize);
+        __atomic_add_fetch(&realloc_inplace, 1, __ATOMIC_RELAXED);
+        return bp;
+    }
+
+    /* Slide the payload down into the free previous block */
+    if (GET_PREV_ALLOC(HDRP(bp)))
+        return NULL;
+    prev = PREV_BLKP(bp);
+    size = GET_SIZE(HDRP(prev)) + csize + nsize;
+    if (size < asize)
+        return NULL;
+    remove_from_explicit_free_list(a, prev);
+    if (nsize)
+        remove_from_explicit_free_list(a, next);
+    memmove(prev, bp, csize - OVERHEAD);
+    PUT_HDR(HDRP(prev), PACK(size, 1));
+    PUT_ALLOC_FTR(prev, PACK(size, 1));
+    SET_PREV_ALLOC(HDRP(NEXT_BLKP(prev)));
+    MARK_USED(a, prev);
+    split_block(a, prev, asize);
+    __atomic_add_fetch(&realloc_moved, 1, __ATOMIC_RELAXED);
+    return prev;
+}
+
+/*
+ * memalign_block - Allocate a block of asize bytes at a multiple of align
+ *                  from arena a. Called with the arena locked.
+ */
+static void *memalign_block(struct arena *a, size_t asize, size_t align)
+{
+    size_t bsize = asize + align + MIN_BLOCK; /* Has an aligned fit for sure */
+    size_t csize;
+    char *bp, *abp;
+
+    if (a->heap_listp == 0 && arena_init(a) < 0)
+        return NULL;
+
+    /* Try the block a plain malloc would get, then one with room to spare */
+    a->search_steps = 0;
+    bp = find_fit(a, asize);
+    if (bp == NULL || align_fit(bp, asize, align) == NULL) {
+        bp = find_fit(a, bsize);
+        if (bp == NULL && a->quick_bytes != 0) {
+            consolidate(a);
+            bp = find_fit(a, bsize);
+        }
+        if (bp == NULL &&
+            (bp = extend_heap(a, MAX(bsize, CHUNKSIZE)/WSIZE)) == NULL) {
+            a->fit_searches[search_bucket(a->search_steps)]++;
+            return NULL;
+        }
+    }
+    a->fit_searches[search_bucket(a->search_steps)]++;
+    abp = align_fit(bp, asize, align);
+    csize = GET_SIZE(HDRP(bp));
+    place(a, bp, csize);
+
+    /* Free the slack in front, then the tail */
+    if (abp != bp) {
+        PUT_HDR(HDRP(bp), PACK(abp - bp, 1));
+        PUT_ALLOC_FTR(bp, PACK(abp - bp, 1));
+        PUT(HDRP(abp), PACK(csize - (abp - bp), 1) | PREV_ALLOC);
+        PUT_ALLOC_FTR(abp, PACK(csize - (abp - bp), 1));
+        free_block(a, bp);
+    }
+    split_block(a, abp, asize);
+    return abp;
+}
+
+/*
+ * align_fit - Where in free block bp an asize-byte block aligned to align
+ *             can go, or NULL. It goes at the start if that is aligned,
+ *             otherwise as far up as possible, so that the slack in front
+ *             stays one large free block. That slack must be big enough
+ *             to be a block of its own.
+ */
+static char *align_fit(void *bp, size_t asize, size_t align)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+    char *abp;
+
+    if (csize < asize)
+        return NULL;
+    if (((uintptr_t)bp & (align - 1)) == 0)
+        return bp;
+    abp = (char *)(((uintptr_t)bp + csize - asize) & ~(uintptr_t)(align - 1));
+    if (abp < (char *)bp + MIN_BLOCK)
+        return NULL;
+    return abp;
+}
+
+/*
+ * split_block - Cut allocated block bp down to asize bytes and free the
+ *               tail, if the tail is big enough to be a block.
+ *               Called with the arena locked.
+ */
+static void split_block(struct arena *a, void *bp, size_t asize)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+    char *tail;
+
+    if (csize - asize < MIN_BLOCK)
+        return;
+    PUT_HDR(HDRP(bp), PACK(asize, 1));
+    PUT_ALLOC_FTR(bp, PACK(asize, 1));
+    tail = NEXT_BLKP(bp);
+    PUT(HDRP(tail), PACK(csize - asize, 1) | PREV_ALLOC);
+    PUT_ALLOC_FTR(tail, PACK(csize - asize, 1));
+    free_block(a, tail);
+}
+
+/* $end mmfree */
+/*
+ * remote_free - Hand block bp to its owning arena a without taking a's lock.
+ *               Any number of threads may push concurrently.
+ */
+static void remote_free(struct arena *a, void *bp)
+{
+    char *head = __atomic_load_n(&a->remote_frees, __ATOMIC_RELAXED);
+
+    do {
+        GET_NEXT_CACHED(bp) = head;
+    } while (!__atomic_compare_exchange_n(&a->remote_frees, &head, (char *)bp, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * drain_remote_frees - Free every block other threads handed to arena a.
+ *                      Called with the arena locked. Only the lock holder
+ *                      takes from the list, and it takes the whole list at
+ *                      once, so pushes never race with a partial pop.
+ */
+static void drain_remote_frees(struct arena *a)
+{
+    char *bp, *next;
+
+    if (__atomic_load_n(&a->remote_frees, __ATOMIC_RELAXED) == NULL)
+        return;
+    bp = __atomic_exchange_n(&a->remote_frees, NULL, __ATOMIC_ACQUIRE);
+    for ( ; bp != NULL; bp = next) {
+        next = GET_NEXT_CACHED(bp);
+        if (!quick_put(a, bp))
+            free_block(a, bp);
+    }
+}
+
+/*
+ * quick_put - Put freed block bp on its quick list instead of coalescing
+ *             it, and consolidate if the lists have grown too big. Returns
+ *             0 if quick lists are off or bp is too large for them.
+ *             Called with the arena locked.
+ */
+static int quick_put(struct arena *a, void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t idx;
+
+    if (size > quick_max)
+        return 0;
+    idx = QUICK_IDX(size);
+    GET_NEXT_CACHED(bp) = a->quick[idx];
+    a->quick[idx] = bp;
+    a->quick_bytes += size;
+    if (a->quick_bytes >= quick_threshold)
+        consolidate(a);
+    return 1;
+}
 
-/* 
- * mm_init - Initialize the memory manager 
+/*
+ * quick_get - Pop a block of exactly asize bytes off the quick lists of
+ *             arena a, or NULL. Called with the arena locked.
  */
-/* $begin mminit */
-int mm_init(int allocAlg) 
+static void *quick_get(struct arena *a, size_t asize)
 {
-    fit_mode = allocAlg;
-    /* Create the initial empty heap */
-    if ((heap_listp = mem_sbrk(4*WSIZE)) == (void *)-1) //line:vm:mm:begininit
-        return -1;
-    PUT(heap_listp, 0);                          /* Alignment padding */
-    PUT(heap_listp + (1*WSIZE), PACK(DSIZE, 1)); /* Prologue header */ 
-    PUT(heap_listp + (2*WSIZE), PACK(DSIZE, 1)); /* Prologue footer */ 
-    PUT(heap_listp + (3*WSIZE), PACK(0, 1));     /* Epilogue header */
-    heap_listp += (2*WSIZE);                     //line:vm:mm:endinit  
-    /* $end mminit */
+    char *bp;
+    size_t idx;
 
-    /* $begin mminit */
+    if (asize > QUICK_MAX_SIZE)
+        return NULL;
+    idx = QUICK_IDX(asize);
+    if ((bp = a->quick[idx]) == NULL)
+        return NULL;
+    a->quick[idx] = GET_NEXT_CACHED(bp);
+    a->quick_bytes -= asize;
+    return bp;
+}
 
-    /* Extend the empty heap with a free block of CHUNKSIZE bytes */
-    if (extend_heap(CHUNKSIZE/WSIZE) == NULL) 
-        return -1;
-    if (fit_mode == 1) {
-        rover = explicit_free_listp;
+/*
+ * consolidate - Free every block on the quick lists of arena a, coalescing
+ *               it with its neighbors. Called with the arena locked.
+ */
+static void consolidate(struct arena *a)
+{
+    char *bp;
+    int i;
+
+    if (a->quick_bytes == 0)
+        return;
+    for (i = 0; i < QUICK_BINS; i++) {
+        while ((bp = a->quick[i]) != NULL) {
+            a->quick[i] = GET_NEXT_CACHED(bp);
+            free_block(a, bp);
+        }
     }
-    return 0;
+    a->quick_bytes = 0;
+    a->consolidations++;
 }
-/* $end mminit */
 
-/* 
- * mm_malloc - Allocate a block with at least size bytes of payload 
+/*
+ * mmap_block - Give a request of size bytes its own mmap region, with the
+ *              block at a multiple of align, a power of two. For an
+ *              alignment beyond a page, a larger region is mapped and the
+ *              pages around the block are unmapped again.
  */
-/* $begin mmmalloc */
-void *mm_malloc(size_t size) 
+static void *mmap_block(size_t size, size_t align)
 {
-    size_t asize;      /* Adjusted block size */
-    size_t extendsize; /* Amount to extend heap if no fit */
-    char *bp;      
+    size_t pagesize = mem_pagesize();
+    size_t slide = (align > pagesize) ? align : MAX(align, MMAP_HDR);
+    size_t maplen, len;
+    char *p, *bp, *start;
 
-    /* $end mmmalloc */
-    if (heap_listp == 0){
-        mm_init(fit_mode);
-    }
-    /* $begin mmmalloc */
-    /* Ignore spurious requests */
-    if (size == 0)
+    if (size > SIZE_MAX - slide - pagesize)
+        return NULL;
+    maplen = (size + slide + pagesize - 1) & ~(pagesize - 1);
+    if ((p = mem_map(maplen)) == NULL)
         return NULL;
+    bp = (char *)(((uintptr_t)p + MMAP_HDR + align - 1) & ~(uintptr_t)(align - 1));
+    start = (char *)((uintptr_t)(bp - MMAP_HDR) & ~(uintptr_t)(pagesize - 1));
+    len = (bp + size - start + pagesize - 1) & ~(pagesize - 1);
+    if (start > p)
+        mem_unmap(p, start - p);
+    if (p + maplen > start + len)
+        mem_unmap(start + len, p + maplen - (start + len));
+
+    MMAP_LEN(bp) = len;
+    MMAP_OFF(bp) = bp - start;
+    __atomic_add_fetch(&mmapped_bytes, len, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&mmapped_regions, 1, __ATOMIC_RELAXED);
+    return bp;
+}
 
-    /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= 2*DSIZE)                                          //line:vm:mm:sizeadjust1
-        asize = 3*DSIZE;                                        //line:vm:mm:sizeadjust2
-    else
-        asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE); //line:vm:mm:sizeadjust3
+/*
+ * remap_block - Resize mmapped block bp to hold size bytes. The region
+ *               may move, but its contents are never copied. A block
+ *               aligned beyond a page may lose that alignment.
+ */
+static void *remap_block(void *bp, size_t size)
+{
+    size_t pagesize = mem_pagesize();
+    size_t oldlen = MMAP_LEN(bp), off = MMAP_OFF(bp), len;
+    char *p;
 
-    /* Search the free list for a fit */
-    if ((bp = find_fit(asize)) != NULL) {  //line:vm:mm:findfitcall
-        place(bp, asize);                  //line:vm:mm:findfitplace
+    if (size > SIZE_MAX - off - pagesize)
+        return NULL;
+    len = (size + off + pagesize - 1) & ~(pagesize - 1);
+    __atomic_add_fetch(&realloc_inplace, 1, __ATOMIC_RELAXED);
+    if (len == oldlen)
         return bp;
-    }
-
-    /* No fit found. Get more memory and place the block */
-    extendsize = MAX(asize,CHUNKSIZE);                 //line:vm:mm:growheap1
-    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)  
-        return NULL;                                  //line:vm:mm:growheap2
-    place(bp, asize);                                 //line:vm:mm:growheap3
+    if ((p = mem_remap((char *)bp - off, oldlen, len)) == NULL)
+        return NULL;
+    bp = p + off;
+    MMAP_LEN(bp) = len;
+    __atomic_add_fetch(&mmapped_bytes, len - oldlen, __ATOMIC_RELAXED);
     return bp;
-} 
-/* $end mmmalloc */
+}
 
-/* 
- * mm_free - Free a block 
+/*
+ * unmap_block - Free mmapped block bp by unmapping its region
  */
-/* $begin mmfree */
-void mm_free(void *bp)
+static void unmap_block(void *bp)
 {
-    /* $end mmfree */
-    if (bp == 0) 
-        return;
+    size_t len = MMAP_LEN(bp);
 
-    /* $begin mmfree */
-    size_t size = GET_SIZE(HDRP(bp));
-    /* $end mmfree */
-    if (heap_listp == 0){
-        mm_init(fit_mode);
-    }
-    /* $begin mmfree */
-
-    PUT(HDRP(bp), PACK(size, 0));
-    PUT(FTRP(bp), PACK(size, 0));
-    coalesce(bp);
+    mem_unmap((char *)bp - MMAP_OFF(bp), len);
+    __atomic_sub_fetch(&mmapped_bytes, len, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&mmapped_regions, 1, __ATOMIC_RELAXED);
 }
 
-/* $end mmfree */
 /*
  * coalesce - Boundary tag coalescing. Return ptr to coalesced block
  */
 /* $begin mmfree */
-static void *coalesce(void *bp) 
+static void *coalesce(struct arena *a, void *bp)
 {
-    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
     size_t size = GET_SIZE(HDRP(bp));
 
     if (prev_alloc && next_alloc) {            /* Case 1 */
-        push_to_explicit_free_list(bp);
+        push_to_explicit_free_list(a, bp);
         return bp;
     }
 
     else if (prev_alloc && !next_alloc) {      /* Case 2 */
-        remove_from_explicit_free_list(NEXT_BLKP(bp));
+        remove_from_explicit_free_list(a, NEXT_BLKP(bp));
         size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        PUT(HDRP(bp), PACK(size, 0));
+        PUT_HDR(HDRP(bp), PACK(size, 0));
         PUT(FTRP(bp), PACK(size,0));
-        push_to_explicit_free_list(bp);
+        push_to_explicit_free_list(a, bp);
     }
 
     else if (!prev_alloc && next_alloc) {      /* Case 3 */
-        remove_from_explicit_free_list(PREV_BLKP(bp));
+        remove_from_explicit_free_list(a, PREV_BLKP(bp));
         size += GET_SIZE(HDRP(PREV_BLKP(bp)));
         PUT(FTRP(bp), PACK(size, 0));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+        PUT_HDR(HDRP(PREV_BLKP(bp)), PACK(size, 0));
         bp = PREV_BLKP(bp);
-        push_to_explicit_free_list(bp);
+        push_to_explicit_free_list(a, bp);
     }
 
     else {                                     /* Case 4 */
-        remove_from_explicit_free_list(PREV_BLKP(bp));
-        remove_from_explicit_free_list(NEXT_BLKP(bp));
+        remove_from_explicit_free_list(a, PREV_BLKP(bp));
+        remove_from_explicit_free_list(a, NEXT_BLKP(bp));
         size += GET_SIZE(HDRP(PREV_BLKP(bp))) + 
             GET_SIZE(FTRP(NEXT_BLKP(bp)));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+        PUT_HDR(HDRP(PREV_BLKP(bp)), PACK(size, 0));
         PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
         bp = PREV_BLKP(bp);
-        push_to_explicit_free_list(bp);
+        push_to_explicit_free_list(a, bp);
     }
     /* $end mmfree */
-if (fit_mode == 1) {
-    /* Make sure the rover isn't pointing into the free block */
-    /* that we just coalesced */
-    if ((rover > (char *)bp) && (rover < GET_SUCC(bp))) 
-        rover = bp;
-}
     /* $begin mmfree */
     return bp;
 }
 /* $end mmfree */
 
 /*
- * mm_realloc - Naive implementation of realloc
+ * mm_realloc - Grow into a free next block if possible, otherwise copy
  */
-void *mm_realloc(void *ptr, size_t size)
+HEAPPROF_ENTRY void *mm_realloc(void *ptr, size_t size)
 {
+    struct arena *a;
     size_t oldsize;
-    void *newptr;
+    void *newptr = NULL;
 
     /* If size == 0 then this is just free, and we return NULL. */
     if(size == 0) {
@@ -235,25 +1591,37 @@ void *mm_realloc(void *ptr, size_t size)
     if(ptr == NULL) {
         return mm_malloc(size);
     }
+    if (size > MAX_REQUEST)
+        return NULL;
 
-    /* in place */
-    size_t asize;
-    if (size <= 2*DSIZE)
-        asize = 3*DSIZE;
-    else
-        asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE);
-    if (GET_SIZE(HDRP(ptr)) >= asize) {
-        return ptr;
-    } else if (!GET_ALLOC(HDRP(NEXT_BLKP(ptr)))) {
-        if (GET_SIZE(HDRP(ptr)) + GET_SIZE(HDRP(NEXT_BLKP(ptr))) >= asize) {
-            place(NEXT_BLKP(ptr), asize - GET_SIZE(HDRP(ptr)));
-            size = GET_SIZE(HDRP(ptr)) + GET_SIZE(HDRP(NEXT_BLKP(ptr)));
-            PUT(HDRP(ptr), PACK(size,1));
-            PUT(FTRP(ptr), PACK(size,1));
-            return ptr;
+    oldsize = mm_usable_size(ptr);
+    if (IS_MMAPPED(ptr)) {
+        /* Let the kernel move the pages instead of copying them */
+        if (size >= mmap_threshold && (newptr = remap_block(ptr, size)) == NULL)
+            return NULL;
+    } else if (IS_SLAB(ptr)) {
+        if (size <= slab_size(ptr))
+            newptr = ptr;
+    } else {
+        /* in place */
+        size_t asize = adjust_size(size);
+        if (GET_SIZE(HDRP(ptr)) >= asize && GET_SIZE(HDRP(ptr)) - asize < MIN_BLOCK) {
+            newptr = ptr;       /* The tail would be too small to split off */
+        } else {
+            a = arena_of(ptr);
+            pthread_mutex_lock(&a->lock);
+            newptr = realloc_block(a, ptr, asize);
+            pthread_mutex_unlock(&a->lock);
         }
     }
+    if (newptr != NULL) {
+        /* Counted as a free of the old block and a new allocation */
+        count_free(ptr, oldsize);
+        return count_alloc(newptr, mm_usable_size(newptr));
+    }
+    __atomic_add_fetch(&realloc_copied, 1, __ATOMIC_RELAXED);
 
+    /* The new block comes from this thread's arena, not necessarily ptr's */
     newptr = mm_malloc(size);
 
     /* If realloc() fails the original block is left untouched  */
@@ -262,7 +1630,6 @@ void *mm_realloc(void *ptr, size_t size)
     }
 
     /* Copy the old data. */
-    oldsize = GET_SIZE(HDRP(ptr));
     if(size < oldsize) oldsize = size;
     memcpy(newptr, ptr, oldsize);
 
@@ -273,38 +1640,54 @@ void *mm_realloc(void *ptr, size_t size)
 }
 
 /* 
- * mm_checkheap - Check the heap for correctness
+ * mm_checkheap - Check the heap of every arena for correctness
  */
 void mm_checkheap(int verbose)  
 { 
-    checkheap(verbose);
+    int i;
+
+    for (i = 0; i < MM_MAX_ARENAS; i++) {
+        struct arena *a = &arenas[i];
+        pthread_mutex_lock(&a->lock);
+        drain_remote_frees(a);
+        if (a->heap_listp != 0)
+            checkheap(a, verbose);
+        pthread_mutex_unlock(&a->lock);
+    }
+    slab_check(verbose);
 }
 
-/* 
- * The remaining routines are internal helper routines 
- */
-
 /* 
  * extend_heap - Extend heap with free block and return its block pointer
  */
 /* $begin mmextendheap */
-static void *extend_heap(size_t words) 
+static void *extend_heap(struct arena *a, size_t words)
 {
-    char *bp;
+    char *bp, *prev;
     size_t size;
 
     /* Allocate an even number of words to maintain alignment */
     size = (words % 2) ? (words+1) * WSIZE : words * WSIZE; //line:vm:mm:beginextend
-    if ((long)(bp = mem_sbrk(size)) == -1)  
+    if (size > (size_t)PTRDIFF_MAX)                         /* mem_sbrk would shrink */
+        return NULL;
+    if ((long)(bp = mem_heap_sbrk(a->heap, size)) == -1)
         return NULL;                                        //line:vm:mm:endextend
 
     /* Initialize free block header/footer and the epilogue header */
-    PUT(HDRP(bp), PACK(size, 0));         /* Free block header */   //line:vm:mm:freeblockhdr
+    PUT_HDR(HDRP(bp), PACK(size, 0));     /* Free block header */   //line:vm:mm:freeblockhdr
     PUT(FTRP(bp), PACK(size, 0));         /* Free block footer */   //line:vm:mm:freeblockftr
     PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */ //line:vm:mm:newepihdr
 
     /* Coalesce if the previous block was free */
-    return coalesce(bp);                                          //line:vm:mm:returnblock
+    if (GET_PREV_ALLOC(HDRP(bp)))
+        return coalesce(a, bp);                                   //line:vm:mm:returnblock
+
+    /* The old footer and epilogue end up inside the merged block; clear
+     * them so that memory above a->fresh stays zero */
+    prev = coalesce(a, bp);
+    PUT((char *)bp - DSIZE, 0);
+    PUT(HDRP(bp), 0);
+    return prev;
 }
 /* $end mmextendheap */
 
@@ -314,25 +1697,33 @@ static void *extend_heap(size_t words)
  */
 /* $begin mmplace */
 /* $begin mmplace-proto */
-static void place(void *bp, size_t asize)
+static void place(struct arena *a, void *bp, size_t asize)
 /* $end mmplace-proto */
 {
     void *pred_bp = GET_PRED(bp);
     void *succ_bp = GET_SUCC(bp);
-    remove_from_explicit_free_list(bp);
+    remove_from_explicit_free_list(a, bp);
     size_t csize = GET_SIZE(HDRP(bp));   
 
-    if ((csize - asize) >= (3*DSIZE)) { 
-        PUT(HDRP(bp), PACK(asize, 1));
-        PUT(FTRP(bp), PACK(asize, 1));
+    if ((csize - asize) >= MIN_BLOCK) { 
+        PUT_HDR(HDRP(bp), PACK(asize, 1));
+        PUT_ALLOC_FTR(bp, PACK(asize, 1));
+        MARK_USED(a, bp);
         bp = NEXT_BLKP(bp);
-        PUT(HDRP(bp), PACK(csize-asize, 0));
+        PUT(HDRP(bp), PACK(csize-asize, 0) | PREV_ALLOC);
         PUT(FTRP(bp), PACK(csize-asize, 0));
-        insert_to_explicit_free_list(bp, pred_bp, succ_bp);
+        if (USES_TREE || fit_mode == 3) {
+            /* The remainder has a new key / may belong to a smaller class */
+            push_to_explicit_free_list(a, bp);
+        } else {
+            insert_to_explicit_free_list(a, bp, pred_bp, succ_bp);
+        }
     }
     else { 
-        PUT(HDRP(bp), PACK(csize, 1));
-        PUT(FTRP(bp), PACK(csize, 1));
+        PUT_HDR(HDRP(bp), PACK(csize, 1));
+        PUT_ALLOC_FTR(bp, PACK(csize, 1));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+        MARK_USED(a, bp);
     }
 }
 /* $end mmplace */
@@ -342,61 +1733,72 @@ static void place(void *bp, size_t asize)
  */
 /* $begin mmfirstfit */
 /* $begin mmfirstfit-proto */
-static void *find_fit(size_t asize)
+static void *find_fit(struct arena *a, size_t asize)
 /* $end mmfirstfit-proto */
 {
     /* $end mmfirstfit */
 
-if (fit_mode == 1) {
-    /* Next fit search */
-    char *oldrover = rover;
-
-    /* Search from the rover to the end of list */
-    for ( ; GET_SIZE(HDRP(rover)) > 0; rover = NEXT_BLKP(rover))
-        if (!GET_ALLOC(HDRP(rover)) && (asize <= GET_SIZE(HDRP(rover))))
-            return rover;
-
-    /* search from start of list to old rover */
-    for (rover = heap_listp; rover < oldrover; rover = NEXT_BLKP(rover))
-        if (!GET_ALLOC(HDRP(rover)) && (asize <= GET_SIZE(HDRP(rover))))
-            return rover;
+if (ADDR_ORDERED) {
+    /* Next fit: the free blocks in address order from the rover up, then
+     * from the bottom of the heap up to the rover. Address-ordered first
+     * fit starts at the bottom. */
+    char *start = (fit_mode == 1) ? a->rover : a->heap_listp;
+    char *bp;
 
+    for (bp = tree_ceiling(a, start); bp != NULL; bp = tree_ceiling(a, bp + DSIZE)) {
+        a->search_steps++;
+        if (asize <= GET_SIZE(HDRP(bp)))
+            return a->rover = bp;
+    }
+    for (bp = tree_ceiling(a, a->heap_listp); bp != NULL && bp < start;
+         bp = tree_ceiling(a, bp + DSIZE)) {
+        a->search_steps++;
+        if (asize <= GET_SIZE(HDRP(bp)))
+            return a->rover = bp;
+    }
     return NULL;  /* no fit found */
 } else if (fit_mode == 0) {
     /* $begin mmfirstfit */
     /* First-fit search */
     void *bp;
 
-    for (bp = explicit_free_listp; bp != NULL; bp = GET_SUCC(bp)) {
+    for (bp = a->explicit_free_listp; bp != NULL; bp = GET_SUCC(bp)) {
+        a->search_steps++;
         if (asize <= GET_SIZE(HDRP(bp))) {
             return bp;
         }
     }
     return NULL; /* No fit */
-} else {
-    /* Best-fit search */
-    void* best_bp = NULL;
-    int best_size = 1024 * 1024;
-
+} else if (fit_mode == 3) {
+    /* Segregated fit: first fit within the request's own class... */
+    int c = size_class(asize);
     void *bp;
 
-    for (bp = explicit_free_listp; bp != NULL; bp = GET_SUCC(bp)) {
-        if (asize <= GET_SIZE(HDRP(bp)) && asize < best_size) {
-            best_size = asize;
-            best_bp = bp;
+    for (bp = a->seg_lists[c]; bp != NULL; bp = GET_SUCC(bp)) {
+        a->search_steps++;
+        if (asize <= GET_SIZE(HDRP(bp))) {
+            return bp;
         }
     }
-    
-    return best_bp;
+
+    /* ...then any block of a larger class fits, so take the first one */
+    unsigned int larger = a->seg_nonempty & ~((2u << c) - 1);
+    if (larger == 0)
+        return NULL; /* No fit */
+    a->search_steps++;
+    return a->seg_lists[__builtin_ctz(larger)];
+} else {
+    /* Best-fit search */
+    return tree_best_fit(a, asize);
 }
 }
 /* $end mmfirstfit */
 
-static void printblock(void *bp) 
+static void printblock(struct arena *a, void *bp)
 {
     size_t hsize, halloc, fsize, falloc;
 
-    checkheap(0);
+    checkheap(a, 0);
     hsize = GET_SIZE(HDRP(bp));
     halloc = GET_ALLOC(HDRP(bp));  
     fsize = GET_SIZE(FTRP(bp));
@@ -407,6 +1809,10 @@ static void printblock(void *bp)
         return;
     }
 
+    if (halloc && !ALLOC_FOOTERS) {
+        printf("%p: header: [%ld:a] footer: none\n", bp, hsize);
+        return;
+    }
     printf("%p: header: [%ld:%c] footer: [%ld:%c]\n", bp, 
            hsize, (halloc ? 'a' : 'f'), 
            fsize, (falloc ? 'a' : 'f')); 
@@ -414,18 +1820,22 @@ static void printblock(void *bp)
 
 static void checkblock(void *bp) 
 {
-    if ((size_t)bp % 8)
+    if ((size_t)bp % DSIZE)
         printf("Error: %p is not doubleword aligned\n", bp);
-    if (GET(HDRP(bp)) != GET(FTRP(bp)))
+    if ((ALLOC_FOOTERS || !GET_ALLOC(HDRP(bp))) &&
+        (GET(HDRP(bp)) & ~PREV_ALLOC) != GET(FTRP(bp)))
         printf("Error: header does not match footer\n");
 }
 
 /* 
- * checkheap - Minimal check of the heap for consistency 
+ * checkheap - Minimal check of the heap of arena a for consistency
  */
-void checkheap(int verbose) 
+void checkheap(struct arena *a, int verbose)
 {
+    char *heap_listp = a->heap_listp;
     char *bp = heap_listp;
+    size_t quick_bytes = 0;
+    int i;
 
     if (verbose)
         printf("Heap (%p):\n", heap_listp);
@@ -436,70 +1846,491 @@ void checkheap(int verbose)
 
     for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
         if (verbose) 
-            printblock(bp);
+            printblock(a, bp);
         checkblock(bp);
+        if (!GET_PREV_ALLOC(HDRP(NEXT_BLKP(bp))) != !GET_ALLOC(HDRP(bp)))
+            printf("Error: prev-alloc bit after %p is wrong\n", bp);
+        if (!GET_ALLOC(HDRP(bp)) && !GET_ALLOC(HDRP(NEXT_BLKP(bp))))
+            printf("Error: free blocks at %p were not coalesced\n", bp);
     }
 
     if (verbose)
-        printblock(bp);
+        printblock(a, bp);
     if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp))))
         printf("Bad epilogue header\n");
+
+    /* Quick-listed blocks stay allocated, each on the list of its size */
+    for (i = 0; i < QUICK_BINS; i++) {
+        for (bp = a->quick[i]; bp != NULL; bp = GET_NEXT_CACHED(bp)) {
+            if (arena_of(bp) != a || !GET_ALLOC(HDRP(bp)) || QUICK_IDX(GET_SIZE(HDRP(bp))) != i)
+                printf("Error: bad block %p on quick list %d\n", bp, i);
+            quick_bytes += GET_SIZE(HDRP(bp));
+        }
+    }
+    if (quick_bytes != a->quick_bytes)
+        printf("Error: quick lists hold %zu bytes, not %zu\n", quick_bytes, a->quick_bytes);
+}
+
+/*
+ * tcache_get - Pop a cached block of exactly asize bytes, or NULL
+ */
+static void *tcache_get(size_t asize)
+{
+    char *bp;
+    size_t idx;
+
+    if (asize > TCACHE_MAX_SIZE)
+        return NULL;
+    idx = TCACHE_IDX(asize);
+    if ((bp = tcache.bins[idx]) == NULL)
+        return NULL;
+    tcache.bins[idx] = GET_NEXT_CACHED(bp);
+    tcache.counts[idx]--;
+    return bp;
+}
+
+/*
+ * tcache_put - Cache a freed block for this thread. Returns 0 if the block
+ *              is too large or its bin is full and it must go to the heap.
+ */
+static int tcache_put(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t idx;
+
+    if (size > TCACHE_MAX_SIZE)
+        return 0;
+    idx = TCACHE_IDX(size);
+    if (tcache.counts[idx] >= TCACHE_COUNT)
+        return 0;
+    if (!tcache.registered) {
+        pthread_once(&tcache_key_once, tcache_make_key);
+        pthread_setspecific(tcache_key, &tcache);
+        tcache.registered = 1;
+    }
+    GET_NEXT_CACHED(bp) = tcache.bins[idx];
+    tcache.bins[idx] = bp;
+    tcache.counts[idx]++;
+    return 1;
+}
+
+/*
+ * tcache_flush - Return all blocks cached by a thread to their arenas.
+ *                Also the thread exit destructor.
+ */
+static void tcache_flush(void *arg)
+{
+    struct tcache *tc = arg;
+    struct arena *a;
+    char *bp;
+    int i;
+
+    for (i = 0; i < TCACHE_BINS; i++) {
+        while ((bp = tc->bins[i]) != NULL) {
+            tc->bins[i] = GET_NEXT_CACHED(bp);
+            a = arena_of(bp);
+            pthread_mutex_lock(&a->lock);
+            free_block(a, bp);
+            pthread_mutex_unlock(&a->lock);
+        }
+        tc->counts[i] = 0;
+    }
+}
+
+static void tcache_make_key(void)
+{
+    pthread_key_create(&tcache_key, tcache_flush);
+}
+
+/*
+ * count_alloc - Count block bp with size bytes of payload as allocated by
+ *               this thread, and let the profiler sample it. Returns bp.
+ */
+HEAPPROF_ENTRY static void *count_alloc(void *bp, size_t size)
+{
+    HEAPPROF_ALLOC(bp, size);
+    if (!COUNT_STATS)
+        return bp;
+    if (!thread_stats.registered)
+        stats_register();
+    STAT_ADD(thread_stats.allocs[size_class(size)], 1);
+    STAT_ADD(thread_stats.live_bytes, size);
+    return bp;
+}
+
+/*
+ * count_free - Count block bp with size bytes of payload as freed by this
+ *              thread, and drop its sample if it has one
+ */
+static void count_free(void *bp, size_t size)
+{
+    HEAPPROF_FREE(bp);
+    if (!COUNT_STATS)
+        return;
+    if (!thread_stats.registered)
+        stats_register();
+    STAT_ADD(thread_stats.frees[size_class(size)], 1);
+    STAT_ADD(thread_stats.live_bytes, -size);
+}
+
+/*
+ * stats_register - Make this thread's counters visible to mm_stats
+ */
+static void stats_register(void)
+{
+    pthread_mutex_lock(&stats_lock);
+    thread_stats.prev = NULL;
+    thread_stats.next = stats_threads;
+    if (stats_threads != NULL)
+        stats_threads->prev = &thread_stats;
+    stats_threads = &thread_stats;
+    thread_stats.registered = 1;
+    pthread_mutex_unlock(&stats_lock);
+
+    /* Last, as pthread_setspecific may allocate */
+    pthread_once(&stats_key_once, stats_make_key);
+    pthread_setspecific(stats_key, &thread_stats);
+}
+
+/*
+ * stats_exit - Thread exit destructor: keep the counters of the thread
+ */
+static void stats_exit(void *arg)
+{
+    struct thread_stats *ts = arg;
+
+    pthread_mutex_lock(&stats_lock);
+    stats_add(&exited_stats, ts);
+    if (ts->prev != NULL)
+        ts->prev->next = ts->next;
+    else
+        stats_threads = ts->next;
+    if (ts->next != NULL)
+        ts->next->prev = ts->prev;
+    memset(ts, 0, sizeof(*ts));    /* Later frees register again */
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static void stats_make_key(void)
+{
+    pthread_key_create(&stats_key, stats_exit);
+}
+
+/*
+ * stats_add - Add the counters of ts to sum. Called with stats_lock held.
+ */
+static void stats_add(struct thread_stats *sum, struct thread_stats *ts)
+{
+    int c;
+
+    for (c = 0; c < MM_SIZE_CLASSES; c++) {
+        sum->allocs[c] += __atomic_load_n(&ts->allocs[c], __ATOMIC_RELAXED);
+        sum->frees[c] += __atomic_load_n(&ts->frees[c], __ATOMIC_RELAXED);
+    }
+    sum->live_bytes += __atomic_load_n(&ts->live_bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * search_bucket - Histogram bucket of a find_fit call that examined steps
+ *                 blocks: 0 for none, b for 2^(b-1) to 2^b - 1
+ */
+static int search_bucket(size_t steps)
+{
+    int b;
+
+    if (steps == 0)
+        return 0;
+    b = (int)(sizeof(long) * 8) - __builtin_clzl(steps);
+    return (b < MM_SEARCH_BUCKETS) ? b : MM_SEARCH_BUCKETS - 1;
 }
 
-void push_to_explicit_free_list(void *bp) {
-    char *old_head = explicit_free_listp;
+/*
+ * size_class - Return the segregated list index for a block of size bytes
+ */
+static int size_class(size_t size)
+{
+    int c = (int)(sizeof(long) * 8) - __builtin_clzl(size - 1) - 5;
+    if (c < 0)
+        return 0;
+    if (c >= NUM_CLASSES)
+        return NUM_CLASSES - 1;
+    return c;
+}
+
+/*
+ * free_list_head - Return the head of the free list a block of size bytes
+ *                  belongs to. Every mode but segregated fit uses a single list.
+ */
+static char **free_list_head(struct arena *a, size_t size)
+{
+    if (fit_mode == 3)
+        return &a->seg_lists[size_class(size)];
+    return &a->explicit_free_listp;
+}
+
+void push_to_explicit_free_list(struct arena *a, void *bp) {
+    if (USES_TREE) {
+        tree_insert(a, bp);
+        return;
+    }
+    char **headp = free_list_head(a, GET_SIZE(HDRP(bp)));
+    char *old_head = *headp;
     if (old_head != NULL) {
         PUT_PTR(PRED_ADDR(old_head), bp);
     }
     PUT_PTR(SUCC_ADDR(bp), old_head);
     PUT_PTR(PRED_ADDR(bp), NULL);
-    explicit_free_listp = bp;
+    *headp = bp;
+    if (fit_mode == 3) {
+        a->seg_nonempty |= 1u << size_class(GET_SIZE(HDRP(bp)));
+    }
 }
 
-void insert_to_explicit_free_list(void *bp, void *pred_bp, void *succ_bp) {
+void insert_to_explicit_free_list(struct arena *a, void *bp, void *pred_bp, void *succ_bp) {
     PUT_PTR(SUCC_ADDR(bp), succ_bp);
     PUT_PTR(PRED_ADDR(bp), pred_bp);
     if (pred_bp != NULL) {
         PUT_PTR(SUCC_ADDR(pred_bp), bp);
     } else {
-        explicit_free_listp = bp;
+        a->explicit_free_listp = bp;
     }
     if (succ_bp != NULL) {
         PUT_PTR(PRED_ADDR(succ_bp), bp);
     }
 }
 
-void remove_from_explicit_free_list(void *bp) {
+void remove_from_explicit_free_list(struct arena *a, void *bp) {
+    if (USES_TREE) {
+        tree_remove(a, bp);
+        return;
+    }
     void *pred_bp = GET_PRED(bp);
     void *succ_bp = GET_SUCC(bp);
     if (pred_bp != NULL) {
         PUT_PTR(SUCC_ADDR(pred_bp), succ_bp);
     } else {
-        explicit_free_listp = succ_bp;
+        *free_list_head(a, GET_SIZE(HDRP(bp))) = succ_bp;
+        if (fit_mode == 3 && succ_bp == NULL) {
+            a->seg_nonempty &= ~(1u << size_class(GET_SIZE(HDRP(bp))));
+        }
     }
     if (succ_bp != NULL) {
         PUT_PTR(PRED_ADDR(succ_bp), pred_bp);
     }
 }
 
-void debug() {
-    printf("debug start\n");
-    printf("heap\n");
+/*
+ * splay - Top-down splay of the tree rooted at t around the key (size, addr).
+ *         Returns the new root, which is the node with that key if present,
+ *         otherwise its in-order neighbour. Adds the nodes visited to
+ *         *steps unless steps is NULL.
+ */
+static char *splay(char *t, size_t size, char *addr, size_t *steps)
+{
+    char *n[2] = {NULL, NULL}; /* Holds the left and right trees while splaying */
+    char *l = (char *)n, *r = (char *)n;
+    char *y;
+
+    if (t == NULL)
+        return NULL;
+    for (;;) {
+        if (steps != NULL)
+            (*steps)++;
+        if (KEY_LESS(size, addr, t)) {
+            if (GET_LEFT(t) == NULL)
+                break;
+            if (KEY_LESS(size, addr, GET_LEFT(t))) {  /* Rotate right */
+                y = GET_LEFT(t);
+                SET_LEFT(t, GET_RIGHT(y));
+                SET_RIGHT(y, t);
+                t = y;
+                if (GET_LEFT(t) == NULL)
+                    break;
+            }
+            SET_LEFT(r, t);                            /* Link right */
+            r = t;
+            t = GET_LEFT(t);
+        } else if (t != addr) {
+            if (GET_RIGHT(t) == NULL)
+                break;
+            if (!KEY_LESS(size, addr, GET_RIGHT(t)) && GET_RIGHT(t) != addr) {
+                y = GET_RIGHT(t);                      /* Rotate left */
+                SET_RIGHT(t, GET_LEFT(y));
+                SET_LEFT(y, t);
+                t = y;
+                if (GET_RIGHT(t) == NULL)
+                    break;
+            }
+            SET_RIGHT(l, t);                           /* Link left */
+            l = t;
+            t = GET_RIGHT(t);
+        } else {
+            break;
+        }
+    }
+    SET_RIGHT(l, GET_LEFT(t));                         /* Assemble */
+    SET_LEFT(r, GET_RIGHT(t));
+    SET_LEFT(t, n[1]);
+    SET_RIGHT(t, n[0]);
+    return t;
+}
+
+/*
+ * tree_insert - Insert free block bp into the best fit or address-ordered tree
+ */
+static void tree_insert(struct arena *a, void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    char *t = splay(a->tree_root, size, bp, NULL);
+
+    if (t == NULL) {
+        SET_LEFT(bp, NULL);
+        SET_RIGHT(bp, NULL);
+    } else if (KEY_LESS(size, bp, t)) {
+        SET_LEFT(bp, GET_LEFT(t));
+        SET_RIGHT(bp, t);
+        SET_LEFT(t, NULL);
+    } else {
+        SET_RIGHT(bp, GET_RIGHT(t));
+        SET_LEFT(bp, t);
+        SET_RIGHT(t, NULL);
+    }
+    a->tree_root = bp;
+}
+
+/*
+ * tree_remove - Remove free block bp from the tree. In the best fit tree its
+ *               size must still be the one it was inserted with.
+ */
+static void tree_remove(struct arena *a, void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    char *t = splay(a->tree_root, size, bp, NULL);
+
+    if (GET_LEFT(t) == NULL) {
+        a->tree_root = GET_RIGHT(t);
+    } else {
+        /* bp is larger than everything on its left, so this splays the
+         * maximum of the left subtree up, leaving it without a right child */
+        a->tree_root = splay(GET_LEFT(t), size, bp, NULL);
+        SET_RIGHT(a->tree_root, GET_RIGHT(t));
+    }
+}
+
+/*
+ * tree_best_fit - Return the smallest free block of at least asize bytes,
+ *                 the lowest addressed one among equal sizes, splayed to
+ *                 the root. A search that finds nothing, or whose block
+ *                 the caller does not take, still splays the path it
+ *                 walked, which keeps every search amortized O(log n).
+ */
+static void *tree_best_fit(struct arena *a, size_t asize)
+{
+    /* No block is at address NULL, so this ends at the best fit or at the
+     * largest block below asize */
+    char *t = splay(a->tree_root, asize, NULL, &a->search_steps);
+    char *r;
+
+    if (t == NULL)
+        return NULL;
+    a->tree_root = t;
+    if (GET_SIZE(HDRP(t)) >= asize)
+        return t;
+
+    /* The best fit is the lowest of t's right subtree. Splay that up and
+     * rotate it to the root. */
+    if (GET_RIGHT(t) == NULL)
+        return NULL;
+    r = splay(GET_RIGHT(t), asize, NULL, &a->search_steps);
+    SET_RIGHT(t, NULL);
+    SET_LEFT(r, t);
+    a->tree_root = r;
+    return r;
+}
+
+/*
+ * tree_ceiling - Return the lowest addressed free block at or above addr,
+ *                splayed to the root, or NULL. Address-ordered tree only.
+ *                Walking the blocks in order this way costs amortized
+ *                O(1) per block, by the splay tree's sequential access
+ *                property.
+ */
+static char *tree_ceiling(struct arena *a, char *addr)
+{
+    char *t = splay(a->tree_root, 0, addr, NULL);
+    char *r;
+
+    if (t == NULL)
+        return NULL;
+    a->tree_root = t;
+    if (t >= addr)
+        return t;
+
+    /* t is the block below addr, the one above is the lowest of its right
+     * subtree. Splay that up and rotate it to the root. */
+    if (GET_RIGHT(t) == NULL)
+        return NULL;
+    r = splay(GET_RIGHT(t), 0, addr, NULL);
+    SET_RIGHT(t, NULL);
+    SET_LEFT(r, t);
+    a->tree_root = r;
+    return r;
+}
+
+static void printtree(char *t)
+{
+    if (t == NULL)
+        return;
+    printtree(GET_LEFT(t));
+    printf("addr=%p prev=%p next=%p size=%zu alloc=%d left=%p right=%p\n", t, PREV_BLKP(t), NEXT_BLKP(t), (size_t)GET_SIZE(HDRP(t)), (int)GET_ALLOC(HDRP(t)), GET_LEFT(t), GET_RIGHT(t));
+    printtree(GET_RIGHT(t));
+}
+
+static void debug_arena(struct arena *a)
+{
     char *bp;
-    for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
-        printf("addr=%p prev=%p next=%p size=%d alloc=%d", bp, PREV_BLKP(bp), NEXT_BLKP(bp), GET_SIZE(HDRP(bp)), GET_ALLOC(HDRP(bp)));
+    for (bp = a->heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        printf("addr=%p prev=%p next=%p size=%zu alloc=%d", bp, PREV_BLKP(bp), NEXT_BLKP(bp), (size_t)GET_SIZE(HDRP(bp)), (int)GET_ALLOC(HDRP(bp)));
         if (!GET_ALLOC(HDRP(bp))) {
             printf(" pred=%p succ=%p", GET_PRED(bp), GET_SUCC(bp));
         }
         printf("\n");
     }
-    printf("explicit free list\n");
-    for (bp = explicit_free_listp; bp != NULL; bp = GET_SUCC(bp)) {
-        printf("addr=%p prev=%p next=%p size=%d alloc=%d", bp, PREV_BLKP(bp), NEXT_BLKP(bp), GET_SIZE(HDRP(bp)), GET_ALLOC(HDRP(bp)));
-        if (!GET_ALLOC(HDRP(bp))) {
-            printf(" pred=%p succ=%p", GET_PRED(bp), GET_SUCC(bp));
+    if (USES_TREE) {
+        printf("%s tree\n", ADDR_ORDERED ? "address-ordered" : "best fit");
+        printtree(a->tree_root);
+        return;
+    }
+    int c;
+    for (c = 0; c < NUM_CLASSES; c++) {
+        char *head = (fit_mode == 3) ? a->seg_lists[c] : a->explicit_free_listp;
+        if (fit_mode == 3) {
+            if (head == NULL)
+                continue;
+            printf("segregated free list %d\n", c);
+        } else {
+            printf("explicit free list\n");
         }
-        printf("\n");
+        for (bp = head; bp != NULL; bp = GET_SUCC(bp)) {
+            printf("addr=%p prev=%p next=%p size=%zu alloc=%d", bp, PREV_BLKP(bp), NEXT_BLKP(bp), (size_t)GET_SIZE(HDRP(bp)), (int)GET_ALLOC(HDRP(bp)));
+            if (!GET_ALLOC(HDRP(bp))) {
+                printf(" pred=%p succ=%p", GET_PRED(bp), GET_SUCC(bp));
+            }
+            printf("\n");
+        }
+        if (fit_mode != 3)
+            break;
+    }
+}
+
+void debug() {
+    printf("debug start\n");
+    int i;
+    for (i = 0; i < MM_MAX_ARENAS; i++) {
+        if (arenas[i].heap_listp == 0)
+            continue;
+        printf("heap %d\n", i);
+        debug_arena(&arenas[i]);
     }
     printf("debug end\n");
 }
@@ -7,7 +7,84 @@ extern void mm_free (void *ptr);
 
 extern void *mm_realloc(void *ptr, size_t size);
 extern void *mm_calloc (size_t nmemb, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern size_t mm_usable_size(void *ptr);
 extern void mm_checkheap(int verbose);
 /* $end mmheader */
 
+/* Parameters for mm_mallopt */
+#define MM_ARENA_MAX 1  /* Number of arenas threads are spread over */
+#define MM_HEAP_MAX  2  /* Bytes each arena's heap may grow to, set before mem_init;
+                           at most 4 GB unless built with -DWIDE_HEADERS=1 */
+#define MM_TRIM_THRESHOLD    3 /* Shrink a heap once its top free block is this big */
+#define MM_RELEASE_THRESHOLD 4 /* madvise away the pages of free blocks this big */
+#define MM_MMAP_THRESHOLD    5 /* Requests this big get their own mmap region */
+#define MM_SLAB_MAX          6 /* Requests up to this big come from slabs, 0 for none */
+#define MM_PROFILE_PERIOD    7 /* Sample an allocation about every this many bytes, 0 for none */
+#define MM_QUICK_MAX         8 /* Frees up to this big wait on quick lists, 0 for none */
+#define MM_QUICK_THRESHOLD   9 /* Coalesce the quick lists once they hold this many bytes */
+#define MM_HUGEPAGES        10 /* Nonzero: back the heaps with transparent huge pages,
+                                  set before mem_init; not with a heap file */
+
+extern int mm_mallopt(int param, size_t value);
+
+/* Size classes of the statistics: class c holds sizes up to 32 << c,
+ * the last class everything larger */
+#define MM_SIZE_CLASSES 20
+/* find_fit search length buckets: bucket 0 counts searches that examined
+ * no block, bucket b those that examined 2^(b-1) to 2^b - 1 blocks */
+#define MM_SEARCH_BUCKETS 16
+
+/* Allocator statistics, filled in by mm_stats */
+struct mm_stats {
+    size_t heap_size;         /* Bytes obtained with mem_sbrk, all arenas */
+    size_t free_bytes;        /* Bytes in free blocks */
+    size_t free_blocks;       /* Number of free blocks */
+    size_t largest_free_block; /* Size of the largest free block */
+    double fragmentation;     /* External fragmentation, 1 - largest / free bytes */
+    size_t live_bytes;        /* Payload bytes of allocated blocks */
+    size_t trimmed_bytes;     /* Total bytes given back by shrinking heaps */
+    size_t released_bytes;    /* Total bytes of free blocks and empty slabs released with madvise */
+    size_t mmapped_bytes;     /* Bytes in live mmap regions */
+    size_t mmapped_regions;   /* Number of live mmap regions */
+    size_t slab_bytes;        /* Bytes in slabs, part of heap_size */
+    size_t slab_used_bytes;   /* Bytes of slab objects handed out */
+    size_t realloc_inplace;   /* Reallocs that resized the block where it was */
+    size_t realloc_moved;     /* Reallocs that slid into the previous free block */
+    size_t realloc_copied;    /* Reallocs that copied into a new block */
+    size_t calloc_fresh;      /* Callocs of fresh memory, not cleared */
+    size_t calloc_cleared;    /* Callocs of recycled memory, cleared */
+    size_t quick_bytes;       /* Bytes of freed blocks on quick lists, not coalesced */
+    size_t consolidations;    /* Passes that coalesced the quick lists */
+    size_t profile_samples;   /* Live sampled blocks */
+    size_t profile_bytes;     /* Live bytes estimated from the samples */
+    size_t trim_threshold;
+    size_t release_threshold;
+    size_t mmap_threshold;
+    int hugepages;            /* MM_HUGEPAGES is set */
+    size_t huge_bytes;        /* Heap bytes backed by transparent huge pages */
+    size_t allocs[MM_SIZE_CLASSES];  /* Allocations by usable size */
+    size_t frees[MM_SIZE_CLASSES];   /* Frees by usable size */
+    size_t free_list_blocks[MM_SIZE_CLASSES]; /* Free heap blocks by block size */
+    size_t fit_searches[MM_SEARCH_BUCKETS];   /* find_fit calls by blocks examined */
+};
+
+extern size_t mm_trim(size_t pad);
+extern void mm_fork_prepare(void);
+extern void mm_fork_done(void);
+extern void mm_stats(struct mm_stats *st);
+extern void mm_stats_dump(int fd);
+
+/* Heaps kept in a file with mem_set_file */
+extern void mm_persist(void);
+extern void mm_set_root(void *p);
+extern void *mm_get_root(void);
+extern int mm_heap_fit_mode(void);
+
+/* Formats of mm_profile_dump */
+#define MM_PROFILE_PPROF  0   /* Text heap profile for pprof */
+#define MM_PROFILE_FOLDED 1   /* One line per stack, for flame graphs */
+
+extern void mm_profile_dump(int fd, int format);
+
 extern void debug();
@@ -0,0 +1,206 @@
+/*
+ * mm_dispatch.c - The allocator as one copy of mm.c per fit mode.
+ *
+ * mm_fit0.c to mm_fit4.c build mm.c once for each fit mode, with the mode
+ * fixed at compile time, so that none of their code tests fit_mode. This
+ * file links them behind the usual mm_* names: mm_init picks the copy of
+ * its fit mode, or of the heaps it reattaches to, and every other call
+ * goes to that copy through a table of its functions. A call costs one
+ * indirect jump more than in a build of mm.c alone.
+ */
+#include <stdio.h>
+#include <stddef.h>
+
+#include "mm.h"
+#include "heapprof.h"
+
+#define FIT_MODES 5
+
+/* The public functions of one copy of mm.c */
+struct mm_ops {
+    int (*init)(int allocAlg);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    void *(*calloc)(size_t nmemb, size_t size);
+    void *(*memalign)(size_t alignment, size_t size);
+    size_t (*usable_size)(void *ptr);
+    void (*checkheap)(int verbose);
+    int (*mallopt)(int param, size_t value);
+    size_t (*trim)(size_t pad);
+    void (*fork_prepare)(void);
+    void (*fork_done)(void);
+    void (*stats)(struct mm_stats *st);
+    void (*stats_dump)(int fd);
+    void (*profile_dump)(int fd, int format);
+    void (*persist)(void);
+    void (*set_root)(void *p);
+    void *(*get_root)(void);
+    int (*heap_fit_mode)(void);
+    void (*debug)(void);
+};
+
+/* Declare the functions of the copy for fit mode n, and list them */
+#define MM_DECLARE(n) \
+    int mm_fit##n##_init(int allocAlg); \
+    void *mm_fit##n##_malloc(size_t size); \
+    void mm_fit##n##_free(void *ptr); \
+    void *mm_fit##n##_realloc(void *ptr, size_t size); \
+    void *mm_fit##n##_calloc(size_t nmemb, size_t size); \
+    void *mm_fit##n##_memalign(size_t alignment, size_t size); \
+    size_t mm_fit##n##_usable_size(void *ptr); \
+    void mm_fit##n##_checkheap(int verbose); \
+    int mm_fit##n##_mallopt(int param, size_t value); \
+    size_t mm_fit##n##_trim(size_t pad); \
+    void mm_fit##n##_fork_prepare(void); \
+    void mm_fit##n##_fork_done(void); \
+    void mm_fit##n##_stats(struct mm_stats *st); \
+    void mm_fit##n##_stats_dump(int fd); \
+    void mm_fit##n##_profile_dump(int fd, int format); \
+    void mm_fit##n##_persist(void); \
+    void mm_fit##n##_set_root(void *p); \
+    void *mm_fit##n##_get_root(void); \
+    int mm_fit##n##_heap_fit_mode(void); \
+    void mm_fit##n##_debug(void);
+#define MM_OPS(n) { \
+    mm_fit##n##_init, mm_fit##n##_malloc, mm_fit##n##_free, mm_fit##n##_realloc, \
+    mm_fit##n##_calloc, mm_fit##n##_memalign, mm_fit##n##_usable_size, \
+    mm_fit##n##_checkheap, mm_fit##n##_mallopt, mm_fit##n##_trim, \
+    mm_fit##n##_fork_prepare, mm_fit##n##_fork_done, mm_fit##n##_stats, \
+    mm_fit##n##_stats_dump, mm_fit##n##_profile_dump, mm_fit##n##_persist, \
+    mm_fit##n##_set_root, mm_fit##n##_get_root, mm_fit##n##_heap_fit_mode, \
+    mm_fit##n##_debug }
+
+MM_DECLARE(0)
+MM_DECLARE(1)
+MM_DECLARE(2)
+MM_DECLARE(3)
+MM_DECLARE(4)
+
+static const struct mm_ops copies[FIT_MODES] = {
+    MM_OPS(0), MM_OPS(1), MM_OPS(2), MM_OPS(3), MM_OPS(4)
+};
+
+/* The copy in use, the first one until mm_init picks another */
+static const struct mm_ops *mm = &copies[0];
+
+/*
+ * mm_init - Initialize the copy for fit mode allocAlg, or for the fit mode
+ *           of the heaps in the heap file, and send every call to it
+ */
+int mm_init(int allocAlg)
+{
+    int mode = copies[0].heap_fit_mode();
+
+    if (mode < 0)
+        mode = allocAlg;
+    if (mode < 0 || mode >= FIT_MODES) {
+        fprintf(stderr, "ERROR: mm_init: no fit mode %d\n", mode);
+        return -1;
+    }
+    mm = &copies[mode];
+    return mm->init(mode);
+}
+
+/*
+ * mm_mallopt - Set a tunable parameter in every copy, so that settings made
+ *              before mm_init hold whichever copy it picks
+ */
+int mm_mallopt(int param, size_t value)
+{
+    int i, ok = 1;
+
+    for (i = 0; i < FIT_MODES; i++)
+        ok &= copies[i].mallopt(param, value);
+    return ok;
+}
+
+int mm_heap_fit_mode(void)
+{
+    return copies[0].heap_fit_mode();
+}
+
+HEAPPROF_ENTRY void *mm_malloc(size_t size)
+{
+    return mm->malloc(size);
+}
+
+void mm_free(void *ptr)
+{
+    mm->free(ptr);
+}
+
+HEAPPROF_ENTRY void *mm_realloc(void *ptr, size_t size)
+{
+    return mm->realloc(ptr, size);
+}
+
+HEAPPROF_ENTRY void *mm_calloc(size_t nmemb, size_t size)
+{
+    return mm->calloc(nmemb, size);
+}
+
+HEAPPROF_ENTRY void *mm_memalign(size_t alignment, size_t size)
+{
+    return mm->memalign(alignment, size);
+}
+
+size_t mm_usable_size(void *ptr)
+{
+    return mm->usable_size(ptr);
+}
+
+void mm_checkheap(int verbose)
+{
+    mm->checkheap(verbose);
+}
+
+size_t mm_trim(size_t pad)
+{
+    return mm->trim(pad);
+}
+
+void mm_fork_prepare(void)
+{
+    mm->fork_prepare();
+}
+
+void mm_fork_done(void)
+{
+    mm->fork_done();
+}
+
+void mm_stats(struct mm_stats *st)
+{
+    mm->stats(st);
+}
+
+void mm_stats_dump(int fd)
+{
+    mm->stats_dump(fd);
+}
+
+void mm_profile_dump(int fd, int format)
+{
+    mm->profile_dump(fd, format);
+}
+
+void mm_persist(void)
+{
+    mm->persist();
+}
+
+void mm_set_root(void *p)
+{
+    mm->set_root(p);
+}
+
+void *mm_get_root(void)
+{
+    return mm->get_root();
+}
+
+void debug()
+{
+    mm->debug();
+}
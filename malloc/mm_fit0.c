@@ -0,0 +1,3 @@
+/* mm.c built for fit_mode 0 alone, LIFO first fit; see mm_dispatch.c */
+#define FIT_MODE 0
+#include "mm.c"
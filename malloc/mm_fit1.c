@@ -0,0 +1,3 @@
+/* mm.c built for fit_mode 1 alone, next fit; see mm_dispatch.c */
+#define FIT_MODE 1
+#include "mm.c"
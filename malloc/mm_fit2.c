@@ -0,0 +1,3 @@
+/* mm.c built for fit_mode 2 alone, best fit; see mm_dispatch.c */
+#define FIT_MODE 2
+#include "mm.c"
@@ -0,0 +1,3 @@
+/* mm.c built for fit_mode 3 alone, segregated fit; see mm_dispatch.c */
+#define FIT_MODE 3
+#include "mm.c"
@@ -0,0 +1,3 @@
+/* mm.c built for fit_mode 4 alone, address-ordered first fit; see mm_dispatch.c */
+#define FIT_MODE 4
+#include "mm.c"
@@ -0,0 +1,29 @@
+/* $begin mmnames */
+/* Names of the public functions of mm.c in the copy built with
+ * -DFIT_MODE=n: mm_malloc becomes mm_fitn_malloc and so on, so that the
+ * copies for all fit modes link into one program behind mm_dispatch.c */
+#define MM_PASTE(n, f) mm_fit ## n ## _ ## f
+#define MM_EXPAND(n, f) MM_PASTE(n, f)
+#define MM_NAME(f) MM_EXPAND(FIT_MODE, f)
+
+#define mm_init          MM_NAME(init)
+#define mm_malloc        MM_NAME(malloc)
+#define mm_free          MM_NAME(free)
+#define mm_realloc       MM_NAME(realloc)
+#define mm_calloc        MM_NAME(calloc)
+#define mm_memalign      MM_NAME(memalign)
+#define mm_usable_size   MM_NAME(usable_size)
+#define mm_checkheap     MM_NAME(checkheap)
+#define mm_mallopt       MM_NAME(mallopt)
+#define mm_trim          MM_NAME(trim)
+#define mm_fork_prepare  MM_NAME(fork_prepare)
+#define mm_fork_done     MM_NAME(fork_done)
+#define mm_stats(st)     MM_NAME(stats)(st)  /* Leaves struct mm_stats alone */
+#define mm_stats_dump    MM_NAME(stats_dump)
+#define mm_profile_dump  MM_NAME(profile_dump)
+#define mm_persist       MM_NAME(persist)
+#define mm_set_root      MM_NAME(set_root)
+#define mm_get_root      MM_NAME(get_root)
+#define mm_heap_fit_mode MM_NAME(heap_fit_mode)
+#define debug            MM_NAME(debug)
+/* $end mmnames */
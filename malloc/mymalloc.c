@@ -3,14 +3,16 @@
 #include <stdlib.h>
 #include "memlib.h"
 #include "mm.h"
+#include "region.h"
 #include "mymalloc.h"
+#include "heapprof.h"
 
 void myinit(int allocAlg) {
     mem_init();
     mm_init(allocAlg);
 }
 
-void* mymalloc(size_t size) {
+HEAPPROF_ENTRY void* mymalloc(size_t size) {
     return mm_malloc(size);
 }
 
@@ -18,10 +20,51 @@ void myfree(void* ptr) {
     mm_free(ptr);
 }
 
-void* myrealloc(void* ptr, size_t size) {
+HEAPPROF_ENTRY void* myrealloc(void* ptr, size_t size) {
     return mm_realloc(ptr, size);
 }
 
+HEAPPROF_ENTRY void* mycalloc(size_t nmemb, size_t size) {
+    return mm_calloc(nmemb, size);
+}
+
+HEAPPROF_ENTRY void* mymemalign(size_t alignment, size_t size) {
+    return mm_memalign(alignment, size);
+}
+
 void mycleanup() {
+    mm_persist();
     mem_deinit();
 }
+
+int mymallopt(int param, size_t value) {
+    return mm_mallopt(param, value);
+}
+
+HEAPPROF_ENTRY struct region *myregion_create(size_t chunk_size) {
+    return region_create(chunk_size);
+}
+
+HEAPPROF_ENTRY void* myregion_alloc(struct region *r, size_t size) {
+    return region_alloc(r, size);
+}
+
+void myregion_reset(struct region *r) {
+    region_reset(r);
+}
+
+void myregion_destroy(struct region *r) {
+    region_destroy(r);
+}
+
+int mypersist(const char *path, void *base) {
+    return mem_set_file(path, base);
+}
+
+void mysetroot(void *p) {
+    mm_set_root(p);
+}
+
+void* mygetroot() {
+    return mm_get_root();
+}
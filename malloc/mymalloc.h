@@ -4,4 +4,17 @@ void myinit(int allocAlg);
 void* mymalloc(size_t size);
 void myfree(void* ptr);
 void* myrealloc(void* ptr, size_t size);
+void* mycalloc(size_t nmemb, size_t size);
+void* mymemalign(size_t alignment, size_t size);
 void mycleanup();
+int mymallopt(int param, size_t value);
+
+struct region;
+struct region *myregion_create(size_t chunk_size);
+void* myregion_alloc(struct region *r, size_t size);
+void myregion_reset(struct region *r);
+void myregion_destroy(struct region *r);
+
+int mypersist(const char *path, void *base);
+void mysetroot(void *p);
+void* mygetroot();
@@ -0,0 +1,184 @@
+/*
+ * region.c - Regions: objects that are all freed together.
+ *
+ * A region hands out memory by bumping a pointer through chunks of
+ * chunk_size bytes, which it gets with mm_malloc. Objects have no
+ * header and are never freed one by one; region_reset frees all of them
+ * at once by moving the pointer back to the first chunk, which keeps the
+ * chunks for the region's next use, and region_destroy gives the chunks
+ * back to mm_free. Objects bigger than a quarter chunk get a chunk of
+ * their own, which region_reset frees, so that a few large objects do not
+ * waste the tails of the regular chunks.
+ *
+ * A region is not locked: only one thread may use it at a time.
+ */
+#include <stdint.h>
+
+#include "region.h"
+#include "mm.h"
+#include "heapprof.h"
+
+/* Objects are aligned like heap blocks */
+#if WIDE_HEADERS
+#define REGION_ALIGN 16
+#else
+#define REGION_ALIGN 8
+#endif
+#define ALIGN(size) (((size) + REGION_ALIGN - 1) & ~(size_t)(REGION_ALIGN - 1))
+
+/* Smallest chunk, so that a chunk holds a few objects */
+#define REGION_MIN_CHUNK 1024
+
+/* Objects start this far into a chunk */
+#define CHUNK_HDR ALIGN(sizeof(struct chunk))
+
+/* Header at the start of every chunk */
+struct chunk {
+    struct chunk *next;        /* Next chunk of the same list */
+    size_t size;               /* Bytes of the chunk, header included */
+};
+
+struct region {
+    struct chunk *chunks;      /* Regular chunks, in the order they are used */
+    struct chunk *cur;         /* Chunk objects are carved from, NULL for none yet */
+    struct chunk *large;       /* Chunks of single large objects */
+    char *next;                /* Next free byte of cur */
+    char *end;                 /* End of cur */
+    size_t chunk_size;         /* Bytes of a regular chunk */
+    size_t bytes;              /* Bytes of all chunks */
+};
+
+static struct chunk *new_chunk(struct region *r, size_t size);
+static void free_chunks(struct region *r, struct chunk *c);
+
+/*
+ * region_create - Create an empty region that grows by chunk_size bytes
+ *                 at a time, or REGION_DEFAULT_CHUNK for 0. Returns NULL
+ *                 when out of memory or for a chunk_size that cannot be
+ *                 aligned.
+ */
+HEAPPROF_ENTRY struct region *region_create(size_t chunk_size)
+{
+    struct region *r;
+
+    if (chunk_size == 0)
+        chunk_size = REGION_DEFAULT_CHUNK;
+    if (chunk_size < REGION_MIN_CHUNK)
+        chunk_size = REGION_MIN_CHUNK;
+    if (chunk_size > SIZE_MAX - CHUNK_HDR - REGION_ALIGN)
+        return NULL;
+    if ((r = mm_malloc(sizeof(struct region))) == NULL)
+        return NULL;
+    r->chunks = r->cur = r->large = NULL;
+    r->next = r->end = NULL;
+    r->chunk_size = ALIGN(chunk_size);
+    r->bytes = 0;
+    return r;
+}
+
+/*
+ * region_alloc - Allocate size bytes from region r. Returns NULL for
+ *                size 0 or when out of memory.
+ */
+HEAPPROF_ENTRY void *region_alloc(struct region *r, size_t size)
+{
+    struct chunk *c;
+    char *p;
+
+    if (size == 0 || size > SIZE_MAX - CHUNK_HDR - REGION_ALIGN)
+        return NULL;
+    size = ALIGN(size);
+
+    /* Fast path: the object fits in the current chunk */
+    if (size <= (size_t)(r->end - r->next)) {
+        p = r->next;
+        r->next += size;
+        return p;
+    }
+
+    if (size > r->chunk_size / 4) {
+        if ((c = new_chunk(r, CHUNK_HDR + size)) == NULL)
+            return NULL;
+        c->next = r->large;
+        r->large = c;
+        return (char *)c + CHUNK_HDR;
+    }
+
+    /* Move on to the next chunk, kept from before the last reset or new */
+    c = r->cur ? r->cur->next : r->chunks;
+    if (c == NULL) {
+        if ((c = new_chunk(r, r->chunk_size)) == NULL)
+            return NULL;
+        c->next = NULL;
+        if (r->cur)
+            r->cur->next = c;
+        else
+            r->chunks = c;
+    }
+    r->cur = c;
+    p = (char *)c + CHUNK_HDR;
+    r->next = p + size;
+    r->end = (char *)c + c->size;
+    return p;
+}
+
+/*
+ * region_reset - Free every object of region r. The regular chunks are
+ *                kept for reuse, so this takes constant time unless the
+ *                region holds large objects.
+ */
+void region_reset(struct region *r)
+{
+    free_chunks(r, r->large);
+    r->large = NULL;
+    r->cur = NULL;
+    r->next = r->end = NULL;
+}
+
+/*
+ * region_destroy - Free every object of region r and the region itself
+ */
+void region_destroy(struct region *r)
+{
+    if (r == NULL)
+        return;
+    free_chunks(r, r->large);
+    free_chunks(r, r->chunks);
+    mm_free(r);
+}
+
+/*
+ * region_size - Bytes of memory region r holds, free or not
+ */
+size_t region_size(struct region *r)
+{
+    return r->bytes;
+}
+
+/*
+ * new_chunk - Get a chunk of size bytes for region r
+ */
+static struct chunk *new_chunk(struct region *r, size_t size)
+{
+    struct chunk *c;
+
+    if ((c = mm_malloc(size)) == NULL)
+        return NULL;
+    c->size = size;
+    r->bytes += size;
+    return c;
+}
+
+/*
+ * free_chunks - Give the chunks of list c of region r back to mm_free
+ */
+static void free_chunks(struct region *r, struct chunk *c)
+{
+    struct chunk *next;
+
+    for (; c != NULL; c = next) {
+        next = c->next;
+        r->bytes -= c->size;
+        mm_free(c);
+    }
+}
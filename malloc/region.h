@@ -0,0 +1,13 @@
+/* $begin regionheader */
+#include <stddef.h>
+
+#define REGION_DEFAULT_CHUNK (64 * 1024) /* Bytes per chunk unless told otherwise */
+
+struct region;
+
+struct region *region_create(size_t chunk_size);
+void *region_alloc(struct region *r, size_t size);
+void region_reset(struct region *r);
+void region_destroy(struct region *r);
+size_t region_size(struct region *r);
+/* $end regionheader */
@@ -0,0 +1,272 @@
+/*
+ * shim.c - The allocator as the process malloc, for LD_PRELOAD.
+ *
+ *     $ make libmymalloc.so
+ *     $ LD_PRELOAD=./libmymalloc.so MM_FIT_MODE=3 ls -l
+ *
+ * MM_FIT_MODE picks the fit_mode, segregated fit by default. If MM_STATS
+ * is set, the statistics of mm_stats_dump are written to the file it
+ * names, or to stderr if it is empty, when the program exits.
+ *
+ * MM_PROFILE=bytes turns the heap profiler on, sampling about every that
+ * many bytes. At exit the call stacks of the live samples are written to
+ * the file MM_PROFILE_OUT names (mm.prof by default), as a pprof heap
+ * profile, or as folded stacks if MM_PROFILE_FORMAT is folded:
+ *
+ *     $ LD_PRELOAD=./libmymalloc.so MM_PROFILE=524288 prog
+ *     $ pprof -text prog mm.prof
+ *
+ * The allocator is set up by the first call. Calls made while that is
+ * under way, from the setup itself or from other threads, are served from
+ * a small static buffer whose memory is never reused. Around fork every
+ * allocator lock is taken, so the child never starts with a lock held by
+ * a thread it does not have.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "memlib.h"
+#include "mm.h"
+#include "heapprof.h"
+
+#define DEFAULT_FIT_MODE 3
+
+/* The process malloc must align every block for any type, max_align_t
+ * included, which is 16 bytes on x86-64; the compact layout gives 8 */
+#if !defined(WIDE_HEADERS) || !WIDE_HEADERS
+#error "shim.c must be built with -DWIDE_HEADERS=1"
+#endif
+
+/* Built with -fvisibility=hidden, so only these functions are exported */
+#define EXPORT __attribute__((visibility("default")))
+
+/* Memory for calls made before the allocator is ready */
+#define BOOT_SIZE  (64 * 1024)
+#define BOOT_ALIGN 16
+#define BOOT_HDR   BOOT_ALIGN     /* Each block is preceded by its size */
+#define IS_BOOT(p) ((char *)(p) >= boot_heap && (char *)(p) < boot_heap + BOOT_SIZE)
+#define BOOT_LEN(p) (*(size_t *)((char *)(p) - sizeof(size_t)))
+
+static char boot_heap[BOOT_SIZE] __attribute__((aligned(BOOT_ALIGN)));
+static size_t boot_used;           /* Updated atomically */
+
+/* 0: not set up, 1: being set up, 2: ready */
+static int state;
+
+/*
+ * boot_alloc - Carve size bytes at a multiple of align out of the static
+ *              buffer. Its memory is zero and is never handed out twice.
+ */
+static void *boot_alloc(size_t size, size_t align)
+{
+    size_t used, start;
+    char *bp;
+
+    if (align < BOOT_ALIGN)
+        align = BOOT_ALIGN;
+    if (size > BOOT_SIZE || align > BOOT_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size = (size + BOOT_ALIGN - 1) & ~(size_t)(BOOT_ALIGN - 1);
+    used = __atomic_load_n(&boot_used, __ATOMIC_RELAXED);
+    do {
+        start = (used + BOOT_HDR + align - 1) & ~(align - 1);
+        if (start + size > BOOT_SIZE) {
+            errno = ENOMEM;
+            return NULL;
+        }
+    } while (!__atomic_compare_exchange_n(&boot_used, &used, start + size, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    bp = boot_heap + start;
+    BOOT_LEN(bp) = size;
+    return bp;
+}
+
+/*
+ * ready - Set the allocator up on the first call. Returns 0 while the
+ *         setup is under way, and the caller must use boot_alloc.
+ */
+static int ready(void)
+{
+    static const char msg[] = "libmymalloc: cannot set up the heap\n";
+    const char *mode, *period;
+    int s = __atomic_load_n(&state, __ATOMIC_ACQUIRE);
+
+    if (s == 2)
+        return 1;
+    if (s != 0 || !__atomic_compare_exchange_n(&state, &s, 1, 0,
+                                               __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+        return 0;
+
+    mode = getenv("MM_FIT_MODE");
+    if (getenv("MM_HUGEPAGES") != NULL)
+        mm_mallopt(MM_HUGEPAGES, 1);
+    mem_init();
+    if (mm_init(mode ? atoi(mode) : DEFAULT_FIT_MODE) < 0) {
+        if (write(2, msg, sizeof(msg) - 1) < 0)
+            ;
+        abort();
+    }
+    pthread_atfork(mm_fork_prepare, mm_fork_done, mm_fork_done);
+    if ((period = getenv("MM_PROFILE")) != NULL)
+        mm_mallopt(MM_PROFILE_PERIOD, strtoul(period, NULL, 0));
+    __atomic_store_n(&state, 2, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/*
+ * dump_stats - Write the statistics out at exit, if MM_STATS asks for it
+ */
+__attribute__((destructor))
+static void dump_stats(void)
+{
+    const char *path = getenv("MM_STATS");
+    int fd = 2;
+
+    if (path == NULL || __atomic_load_n(&state, __ATOMIC_ACQUIRE) != 2)
+        return;
+    if (*path != '\0' && (fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        return;
+    mm_stats_dump(fd);
+    if (fd != 2)
+        close(fd);
+}
+
+/*
+ * dump_profile - Write the heap profile out at exit, if MM_PROFILE is set
+ */
+__attribute__((destructor))
+static void dump_profile(void)
+{
+    const char *path = getenv("MM_PROFILE_OUT");
+    const char *format = getenv("MM_PROFILE_FORMAT");
+    int fd;
+
+    if (getenv("MM_PROFILE") == NULL || __atomic_load_n(&state, __ATOMIC_ACQUIRE) != 2)
+        return;
+    if ((fd = open(path ? path : "mm.prof", O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        return;
+    mm_profile_dump(fd, (format && strcmp(format, "folded") == 0) ?
+                    MM_PROFILE_FOLDED : MM_PROFILE_PPROF);
+    close(fd);
+}
+
+EXPORT HEAPPROF_ENTRY void *malloc(size_t size)
+{
+    void *p;
+
+    if (!ready())
+        return boot_alloc(size, BOOT_ALIGN);
+    if ((p = mm_malloc(size ? size : 1)) == NULL)
+        errno = ENOMEM;
+    return p;
+}
+
+EXPORT void free(void *p)
+{
+    if (p == NULL || IS_BOOT(p))
+        return;
+    mm_free(p);
+}
+
+EXPORT HEAPPROF_ENTRY void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (nmemb != 0 && size > SIZE_MAX / nmemb) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (!ready())
+        return boot_alloc(nmemb * size, BOOT_ALIGN);
+    if (nmemb == 0 || size == 0)
+        nmemb = size = 1;
+    if ((p = mm_calloc(nmemb, size)) == NULL)
+        errno = ENOMEM;
+    return p;
+}
+
+EXPORT HEAPPROF_ENTRY void *realloc(void *p, size_t size)
+{
+    void *newp;
+
+    if (p == NULL)
+        return malloc(size);
+    if (size == 0) {
+        free(p);
+        return NULL;
+    }
+    if (IS_BOOT(p)) {
+        /* Boot blocks are not resized, only copied out */
+        if ((newp = malloc(size)) != NULL)
+            memcpy(newp, p, BOOT_LEN(p) < size ? BOOT_LEN(p) : size);
+        return newp;
+    }
+    if ((newp = mm_realloc(p, size)) == NULL)
+        errno = ENOMEM;
+    return newp;
+}
+
+EXPORT HEAPPROF_ENTRY void *memalign(size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (!ready())
+        return boot_alloc(size, alignment);
+    if ((p = mm_memalign(alignment, size ? size : 1)) == NULL)
+        errno = ENOMEM;
+    return p;
+}
+
+EXPORT HEAPPROF_ENTRY int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    if ((p = memalign(alignment, size)) == NULL)
+        return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+EXPORT HEAPPROF_ENTRY void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+EXPORT HEAPPROF_ENTRY void *valloc(size_t size)
+{
+    return memalign(mem_pagesize(), size);
+}
+
+EXPORT HEAPPROF_ENTRY void *pvalloc(size_t size)
+{
+    size_t pagesize = mem_pagesize();
+
+    if (size > SIZE_MAX - pagesize) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return memalign(pagesize, (size + pagesize - 1) & ~(pagesize - 1));
+}
+
+EXPORT size_t malloc_usable_size(void *p)
+{
+    if (p == NULL)
+        return 0;
+    if (IS_BOOT(p))
+        return BOOT_LEN(p);
+    return mm_usable_size(p);
+}
@@ -0,0 +1,481 @@
+/*
+ * slab.c - Allocation of small fixed-size objects without per-object
+ * headers.
+ *
+ * Objects of up to SLAB_MAX_SIZE bytes are carved out of page-sized
+ * slabs, one size class per 8 bytes, or per 16 with -DWIDE_HEADERS=1.
+ * Each slab holds objects of a single size behind a small slab header at
+ * the start of its page, and the slab of an object is found by rounding
+ * the object's address down to the page. Free objects are chained through their first word, so both
+ * allocation and free are O(1).
+ *
+ * All slabs come from a memlib heap of their own, which is how the
+ * allocator tells slab objects from boundary-tag blocks. A slab whose
+ * objects have all been freed goes to a pool of empty slabs that any
+ * size class can reuse. slab_trim gives the pool back to the OS: it
+ * shrinks the heap past the empty slabs at its top and gathers the
+ * others into runs of adjacent slabs, releasing every page of a run but
+ * the first, which keeps the run in the pool.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "slab.h"
+#include "memlib.h"
+
+/* Objects are aligned like heap blocks */
+#if WIDE_HEADERS
+#define SLAB_ALIGN   16
+#else
+#define SLAB_ALIGN   8
+#endif
+#define SLAB_CLASSES (SLAB_MAX_SIZE / SLAB_ALIGN)
+
+/* Size class of an object of size bytes, and the object size of class c */
+#define SLAB_CLASS(size)  (((size) + SLAB_ALIGN - 1) / SLAB_ALIGN - 1)
+#define CLASS_SIZE(c)     (((c) + 1) * SLAB_ALIGN)
+
+/* Objects start this far into a slab */
+#define SLAB_HDR ((sizeof(struct slab) + 2*SLAB_ALIGN - 1) & ~(2*SLAB_ALIGN - 1))
+
+/* Given object p, compute the address of its slab */
+#define SLAB_OF(p) ((struct slab *)((uintptr_t)(p) & ~(uintptr_t)(slab_pagesize - 1)))
+
+/* Free objects are chained through their first word */
+#define NEXT_FREE(p) (*(char **)(p))
+
+/* Header at the start of every slab */
+struct slab {
+    struct slab *next;         /* Next slab in the partial or empty list */
+    struct slab *prev;         /* Previous slab in the partial list */
+    char *free;                /* Objects freed back to this slab */
+    char *unused;              /* Objects from here on were never handed out */
+    int zeroed;                /* ... and are zero, the slab is fresh from mem_sbrk */
+    unsigned int size;         /* Object size */
+    unsigned int inuse;        /* Objects handed out */
+    unsigned int total;        /* Objects that fit in the slab, or slabs in
+                                  its run while in the empty list */
+};
+
+/* The slabs of one size class, guarded by the class lock */
+struct slab_class {
+    pthread_mutex_t lock;
+    struct slab *partial;      /* Slabs with at least one free object */
+    size_t nslabs;             /* Slabs owned by the class, partial or full */
+    size_t inuse;              /* Objects handed out */
+};
+
+/* Global variables */
+static struct slab_class classes[SLAB_CLASSES] = {
+    [0 ... SLAB_CLASSES-1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+static pthread_mutex_t empty_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct slab *empty_slabs;   /* Runs of recycled slabs, guarded by empty_lock */
+static size_t nempty;              /* Slabs in those runs */
+static size_t trimmed_bytes;       /* Given back by slab_trim, guarded by empty_lock */
+static size_t released_bytes;
+static int slab_heap;              /* memlib heap the slabs come from */
+static size_t slab_pagesize;
+
+/* Function prototypes for internal helper routines */
+static void *slab_get(size_t size, int *zeroed);
+static struct slab *new_slab(struct slab_class *c, unsigned int size);
+static void partial_push(struct slab_class *c, struct slab *s);
+static void partial_remove(struct slab_class *c, struct slab *s);
+static void empty_push(struct slab *s);
+static struct slab *sort_runs(struct slab *list, size_t n);
+
+/*
+ * slab_init - Forget all slabs and take future ones from memlib heap
+ *    heap, which must not be used by anyone else.
+ */
+void slab_init(int heap)
+{
+    int i;
+
+    for (i = 0; i < SLAB_CLASSES; i++) {
+        classes[i].partial = NULL;
+        classes[i].nslabs = 0;
+        classes[i].inuse = 0;
+    }
+    empty_slabs = NULL;
+    nempty = 0;
+    trimmed_bytes = released_bytes = 0;
+    slab_heap = heap;
+    slab_pagesize = mem_pagesize();
+}
+
+/*
+ * slab_alloc - Allocate an object of size bytes, 0 < size <= SLAB_MAX_SIZE.
+ *    Returns NULL if no slab can be had.
+ */
+void *slab_alloc(size_t size)
+{
+    int zeroed;
+
+    return slab_get(size, &zeroed);
+}
+
+/*
+ * slab_calloc - slab_alloc, but the object is zeroed. Objects never handed
+ *    out of a fresh slab are zero already.
+ */
+void *slab_calloc(size_t size)
+{
+    int zeroed;
+    char *p = slab_get(size, &zeroed);
+
+    if (p != NULL && !zeroed)
+        memset(p, 0, size);
+    return p;
+}
+
+/*
+ * The remaining routines are internal helper routines
+ */
+
+/*
+ * slab_get - Allocate an object of size bytes and tell whether it is
+ *    known to be zero
+ */
+static void *slab_get(size_t size, int *zeroed)
+{
+    int ci = SLAB_CLASS(size);
+    struct slab_class *c = &classes[ci];
+    struct slab *s;
+    char *p;
+
+    pthread_mutex_lock(&c->lock);
+    if ((s = c->partial) == NULL &&
+        (s = new_slab(c, CLASS_SIZE(ci))) == NULL) {
+        pthread_mutex_unlock(&c->lock);
+        return NULL;
+    }
+    if (s->free != NULL) {
+        p = s->free;
+        s->free = NEXT_FREE(p);
+        *zeroed = 0;
+    } else {
+        p = s->unused;
+        s->unused += s->size;
+        *zeroed = s->zeroed;
+    }
+    s->inuse++;
+    c->inuse++;
+    if (s->inuse == s->total)
+        partial_remove(c, s);          /* Full */
+    pthread_mutex_unlock(&c->lock);
+    return p;
+}
+
+/*
+ * slab_free - Free an object allocated by slab_alloc
+ */
+void slab_free(void *p)
+{
+    struct slab *s = SLAB_OF(p);
+    struct slab_class *c = &classes[SLAB_CLASS(s->size)];
+
+    pthread_mutex_lock(&c->lock);
+    NEXT_FREE(p) = s->free;
+    s->free = p;
+    if (s->inuse == s->total)
+        partial_push(c, s);            /* No longer full */
+    s->inuse--;
+    c->inuse--;
+
+    /* Recycle an empty slab, unless it is the last one of its class */
+    if (s->inuse == 0 && (c->partial != s || s->next != NULL)) {
+        partial_remove(c, s);
+        c->nslabs--;
+        empty_push(s);
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+/*
+ * slab_size - Usable size of slab object p
+ */
+size_t slab_size(void *p)
+{
+    return SLAB_OF(p)->size;
+}
+
+/*
+ * slab_owns - Is p an object allocated by slab_alloc?
+ */
+int slab_owns(void *p)
+{
+    return mem_heap_id(p) == slab_heap;
+}
+
+/*
+ * slab_stats - Bytes in all slabs, and bytes of the objects handed out
+ */
+void slab_stats(size_t *slab_bytes, size_t *used_bytes)
+{
+    size_t nslabs = 0, used = 0;
+    int i;
+
+    for (i = 0; i < SLAB_CLASSES; i++) {
+        pthread_mutex_lock(&classes[i].lock);
+        nslabs += classes[i].nslabs;
+        used += classes[i].inuse * CLASS_SIZE(i);
+        pthread_mutex_unlock(&classes[i].lock);
+    }
+    pthread_mutex_lock(&empty_lock);
+    nslabs += nempty;
+    pthread_mutex_unlock(&empty_lock);
+    *slab_bytes = nslabs * slab_pagesize;
+    *used_bytes = used;
+}
+
+/*
+ * slab_trim - Give the memory of empty slabs back to the OS. Shrinks the
+ *    slab heap past the empty slabs at its top and releases the pages of
+ *    the other runs of empty slabs, all but the first of each. Returns
+ *    the bytes given back.
+ */
+size_t slab_trim(void)
+{
+    size_t unit = mem_commit_unit(), trimmed = 0, released = 0, n = 0;
+    struct slab *s, *next, *run;
+    char *brk, *end;
+    int i;
+
+    /* The empty slab that slab_free leaves with its class goes too */
+    for (i = 0; i < SLAB_CLASSES; i++) {
+        struct slab_class *c = &classes[i];
+        pthread_mutex_lock(&c->lock);
+        for (s = c->partial; s != NULL; s = next) {
+            next = s->next;
+            if (s->inuse == 0) {
+                partial_remove(c, s);
+                c->nslabs--;
+                empty_push(s);
+            }
+        }
+        pthread_mutex_unlock(&c->lock);
+    }
+
+    pthread_mutex_lock(&empty_lock);
+    /* Highest first, and join each run to the run just below it */
+    for (s = empty_slabs; s != NULL; s = s->next)
+        n++;
+    empty_slabs = sort_runs(empty_slabs, n);
+    for (run = empty_slabs; run != NULL && (next = run->next) != NULL; ) {
+        if ((char *)next + next->total * slab_pagesize == (char *)run) {
+            next->total += run->total;
+            if (run == empty_slabs)
+                empty_slabs = next;
+            else
+                s->next = next;
+        } else {
+            s = run;
+        }
+        run = next;
+    }
+
+    /* Shrink the heap to the commit unit boundary at or above the top run,
+     * where memlib drops the memory above the brk */
+    brk = mem_heap_sbrk(slab_heap, 0);
+    if ((run = empty_slabs) != NULL &&
+        (char *)run + run->total * slab_pagesize == brk) {
+        end = (char *)(((uintptr_t)run + unit - 1) & ~(uintptr_t)(unit - 1));
+        next = run->next;              /* Before its page goes */
+        if (end < brk && mem_heap_sbrk(slab_heap, end - brk) != (void *)-1) {
+            trimmed = brk - end;
+            nempty -= trimmed / slab_pagesize;
+            if (end == (char *)run)
+                empty_slabs = next;
+            else
+                run->total -= trimmed / slab_pagesize;
+        }
+    }
+
+    /* The first slab of a run holds it in the list */
+    for (run = empty_slabs; run != NULL; run = run->next)
+        if (run->total > 1)
+            released += mem_release((char *)run + slab_pagesize,
+                                    (char *)run + run->total * slab_pagesize);
+    trimmed_bytes += trimmed;
+    released_bytes += released;
+    pthread_mutex_unlock(&empty_lock);
+    return trimmed + released;
+}
+
+/*
+ * slab_trim_stats - Bytes slab_trim gave back by shrinking the heap and
+ *    by releasing pages, since slab_init
+ */
+void slab_trim_stats(size_t *trimmed, size_t *released)
+{
+    pthread_mutex_lock(&empty_lock);
+    *trimmed = trimmed_bytes;
+    *released = released_bytes;
+    pthread_mutex_unlock(&empty_lock);
+}
+
+/*
+ * slab_lock_all - Take every slab lock, for fork. slab_unlock_all releases them.
+ */
+void slab_lock_all(void)
+{
+    int i;
+
+    for (i = 0; i < SLAB_CLASSES; i++)
+        pthread_mutex_lock(&classes[i].lock);
+    pthread_mutex_lock(&empty_lock);
+}
+
+void slab_unlock_all(void)
+{
+    int i;
+
+    pthread_mutex_unlock(&empty_lock);
+    for (i = SLAB_CLASSES - 1; i >= 0; i--)
+        pthread_mutex_unlock(&classes[i].lock);
+}
+
+/*
+ * slab_check - Check the partial slabs of every class for consistency
+ */
+void slab_check(int verbose)
+{
+    struct slab *s;
+    char *p;
+    unsigned int nfree;
+    int i;
+
+    for (i = 0; i < SLAB_CLASSES; i++) {
+        struct slab_class *c = &classes[i];
+        pthread_mutex_lock(&c->lock);
+        for (s = c->partial; s != NULL; s = s->next) {
+            if (verbose)
+                printf("slab %p: size %u, %u/%u in use\n", (void *)s,
+                       s->size, s->inuse, s->total);
+            if (s->size != CLASS_SIZE(i))
+                printf("Error: slab %p is in the wrong class\n", (void *)s);
+            if (s->inuse >= s->total)
+                printf("Error: full slab %p is in the partial list\n", (void *)s);
+            if (s->next != NULL && s->next->prev != s)
+                printf("Error: partial list of class %d is broken\n", i);
+            nfree = (s->total * s->size - (s->unused - ((char *)s + SLAB_HDR))) / s->size;
+            for (p = s->free; p != NULL; p = NEXT_FREE(p)) {
+                if (SLAB_OF(p) != s || (p - ((char *)s + SLAB_HDR)) % s->size)
+                    printf("Error: bad free object %p in slab %p\n", p, (void *)s);
+                nfree++;
+            }
+            if (nfree != s->total - s->inuse)
+                printf("Error: slab %p has %u free objects, expected %u\n",
+                       (void *)s, nfree, s->total - s->inuse);
+        }
+        pthread_mutex_unlock(&c->lock);
+    }
+}
+
+/*
+ * new_slab - Give class c a slab of size-byte objects, recycling an empty
+ *    slab if there is one. Called with the class locked.
+ */
+static struct slab *new_slab(struct slab_class *c, unsigned int size)
+{
+    struct slab *s;
+
+    pthread_mutex_lock(&empty_lock);
+    if ((s = empty_slabs) != NULL) {
+        /* Take the last slab of the run, so that the run stays in place */
+        if (s->total > 1)
+            s = (struct slab *)((char *)s + --s->total * slab_pagesize);
+        else
+            empty_slabs = s->next;
+        nempty--;
+        s->zeroed = 0;
+    } else if ((s = mem_heap_sbrk(slab_heap, slab_pagesize)) != (void *)-1) {
+        s->zeroed = 1;
+    } else {
+        s = NULL;
+    }
+    pthread_mutex_unlock(&empty_lock);
+    if (s == NULL)
+        return NULL;
+
+    s->free = NULL;
+    s->unused = (char *)s + SLAB_HDR;
+    s->size = size;
+    s->inuse = 0;
+    s->total = (slab_pagesize - SLAB_HDR) / size;
+    c->nslabs++;
+    partial_push(c, s);
+    return s;
+}
+
+/*
+ * partial_push - Put slab s at the front of the partial list of class c
+ */
+static void partial_push(struct slab_class *c, struct slab *s)
+{
+    s->prev = NULL;
+    s->next = c->partial;
+    if (c->partial != NULL)
+        c->partial->prev = s;
+    c->partial = s;
+}
+
+/*
+ * partial_remove - Take slab s off the partial list of class c
+ */
+static void partial_remove(struct slab_class *c, struct slab *s)
+{
+    if (s->prev != NULL)
+        s->prev->next = s->next;
+    else
+        c->partial = s->next;
+    if (s->next != NULL)
+        s->next->prev = s->prev;
+}
+
+/*
+ * empty_push - Put empty slab s in the pool, as a run of its own
+ */
+static void empty_push(struct slab *s)
+{
+    pthread_mutex_lock(&empty_lock);
+    s->total = 1;
+    s->next = empty_slabs;
+    empty_slabs = s;
+    nempty++;
+    pthread_mutex_unlock(&empty_lock);
+}
+
+/*
+ * sort_runs - Merge sort the n runs of list, highest address first
+ */
+static struct slab *sort_runs(struct slab *list, size_t n)
+{
+    struct slab *a, *b, *head = NULL, **tail = &head;
+    size_t i;
+
+    if (n < 2)
+        return list;
+    for (a = list, i = 1; i < n / 2; i++)
+        a = a->next;
+    b = a->next;
+    a->next = NULL;
+    a = sort_runs(list, n / 2);
+    b = sort_runs(b, n - n / 2);
+    while (a != NULL && b != NULL) {
+        if (a > b) {
+            *tail = a;
+            a = a->next;
+        } else {
+            *tail = b;
+            b = b->next;
+        }
+        tail = &(*tail)->next;
+    }
+    *tail = (a != NULL) ? a : b;
+    return head;
+}
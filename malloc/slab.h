@@ -0,0 +1,18 @@
+/* $begin slabheader */
+#include <stddef.h>
+
+#define SLAB_MAX_SIZE 64 /* Largest object size served from slabs */
+
+void slab_init(int heap);
+void *slab_alloc(size_t size);
+void *slab_calloc(size_t size);
+void slab_free(void *p);
+size_t slab_size(void *p);
+int slab_owns(void *p);
+void slab_stats(size_t *slab_bytes, size_t *used_bytes);
+size_t slab_trim(void);
+void slab_trim_stats(size_t *trimmed, size_t *released);
+void slab_lock_all(void);
+void slab_unlock_all(void);
+void slab_check(int verbose);
+/* $end slabheader */